@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Runs an allocation-heavy benchmark (bench/map.ace by default) under a few
+# collector configurations and prints the wall time and the runtime's GC
+# report for each. The program is built once; the settings go in through the
+# ACE_GC_* variables that -gc-* flags would otherwise bake in.
+
+program=${1:-bench/map.ace}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+(cd "$dir" && ace build -O2 "$OLDPWD/$program") >/dev/null || exit 1
+bin=$dir/$(basename "$program" .ace)
+
+run() {
+  echo "== $*"
+  start=$(date +%s%N)
+  env ACE_GC_STATS=1 "$@" "$bin" >/dev/null || exit 1
+  end=$(date +%s%N)
+  echo "wall: $(((end - start) / 1000000)) ms"
+}
+
+run ACE_GC_MARKERS=1
+run ACE_GC_MARKERS="$(nproc)"
+run ACE_GC_MARKERS="$(nproc)" ACE_GC_INCREMENTAL=1
+run ACE_GC_MARKERS="$(nproc)" ACE_GC_INITIAL_HEAP=256m
+run ACE_GC_MARKERS="$(nproc)" ACE_GC_FREE_SPACE_DIVISOR=1
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Scans a directory of generated log files (2000 by default) with
+# bench/logscan.ace three ways: readlines on one file after another, and
+# read_batched with and without io_uring. The page cache is dropped before
+# each run when this runs as root, since reads from the cache hardly wait.
+
+files=${1:-2000}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/logs"
+for ((i = 0; i < files; i++)); do
+  seq -f "%.0f INFO request $i handled in 12ms" $((RANDOM % 400)) \
+    > "$dir/logs/$i.log"
+done
+(cd "$dir" && ace build -O2 "$OLDPWD/bench/logscan.ace") >/dev/null || exit 1
+
+drop_caches() {
+  sync
+  [ -w /proc/sys/vm/drop_caches ] && echo 3 > /proc/sys/vm/drop_caches
+}
+
+drop_caches
+"$dir/logscan" readlines "$dir"/logs/*.log || exit 1
+drop_caches
+ACE_IO_URING=0 "$dir/logscan" "$dir"/logs/*.log || exit 1
+drop_caches
+"$dir/logscan" "$dir"/logs/*.log || exit 1
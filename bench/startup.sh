@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Compares the latency of `ace run` (build a binary, then exec it) against
+# `ace run -jit` (run the module in-process). The first -jit run builds and
+# caches the runtime shared object, so it is excluded from the timings.
+
+program=${1:-bench/hello.ace}
+iterations=${2:-10}
+
+time_runs() {
+  local start end
+  start=$(date +%s%N)
+  for _ in $(seq "$iterations"); do
+    "$@" >/dev/null || exit 1
+  done
+  end=$(date +%s%N)
+  echo $(((end - start) / iterations / 1000000))
+}
+
+ace run -jit "$program" >/dev/null || exit 1
+
+echo "ace run:      $(time_runs ace run "$program") ms per run"
+echo "ace run -jit: $(time_runs ace run -jit "$program") ms per run"
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Pipes a generated log of short lines through apps/tee.ace and reports the
+# wall time, and the number of write syscalls when strace is available.
+
+lines=${1:-5000000}
+dir=$(mktemp -d)
+log=$dir/log.txt
+out=$dir/out.txt
+tee_bin=$dir/tee
+trap 'rm -rf "$dir"' EXIT
+
+seq -f "%.0f INFO request handled in 12ms" "$lines" > "$log"
+(cd "$dir" && ace build -O2 "$OLDPWD/apps/tee.ace") >/dev/null || exit 1
+
+start=$(date +%s%N)
+"$tee_bin" "$out" < "$log" >/dev/null || exit 1
+end=$(date +%s%N)
+cmp -s "$log" "$out" || { echo "tee output differs from its input"; exit 1; }
+echo "tee: $(((end - start) / 1000000)) ms for $(wc -c < "$log") bytes"
+
+if command -v strace >/dev/null; then
+  writes=$(strace -f -c -e trace=write,writev "$tee_bin" "$out" < "$log" 2>&1 >/dev/null |
+    awk '$NF == "write" || $NF == "writev" { n += $4 } END { print n }')
+  echo "tee: ${writes} write syscalls"
+fi
@@ -0,0 +1,457 @@
+/* Batched file reads for lib/batchio.ace.
+ *
+ * A batch reads a list of files one after the other, but keeps the next
+ * `depth` of them open with a read already requested through io_uring. The
+ * reads for all of those go to the kernel in a single io_uring_enter(2), and
+ * are served while the program is still busy with the file before, so a scan
+ * of thousands of small files is not one blocking open-read-read-close round
+ * trip after another. Once a chunk has been handed over, the next chunk of the
+ * same file is requested straight away, so big files are read ahead as well.
+ *
+ * Each file has one chunk buffer, which the line reader copies out of. Bytes
+ * land there from the kernel, so the buffers come from malloc rather than the
+ * collector, and ace_io_batch_close waits out any read still in flight before
+ * freeing them. The batch itself is collected, which keeps its line reader
+ * alive.
+ *
+ * Where io_uring is missing (an old kernel or libc headers, not Linux, or
+ * refused by a seccomp filter) or ACE_IO_URING=0, the batch opens one file at
+ * a time and reads it with ace_read, as readlines does. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ACE_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef ACE_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+struct ace_line_reader;
+typedef int64_t (*ace_line_source_fn)(void *source, char *pb, int64_t cb);
+struct ace_line_reader *ace_line_reader_from(void *source,
+                                             ace_line_source_fn fill,
+                                             int64_t capacity);
+void ace_line_reader_restart(struct ace_line_reader *reader);
+void *ace_heap_malloc(uint64_t cb);
+int64_t ace_open(const char *path, int64_t flags, int64_t mode);
+int64_t ace_close(int64_t fd);
+int64_t ace_read(int64_t fd, char *pb, int64_t nbyte);
+
+#define BATCH_MIN_CHUNK 4096
+#define BATCH_MAX_DEPTH 4096
+
+enum slot_state {
+  /* open, with nothing requested yet (always the case without a ring). */
+  slot_idle,
+  slot_reading,
+  /* buf[pos, len) has yet to be handed over. */
+  slot_ready,
+  /* at the end of the file, or failed with err. */
+  slot_done,
+};
+
+struct ace_io_slot {
+  int64_t fd;
+  int64_t err;
+  enum slot_state state;
+  char *buf;
+  int64_t len;
+  int64_t pos;
+  /* where in the file the next chunk starts. */
+  int64_t offset;
+#ifdef ACE_HAVE_IO_URING
+  struct iovec iov;
+#endif
+};
+
+#ifdef ACE_HAVE_IO_URING
+struct ace_io_ring {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;
+  size_t cq_map_len;
+  size_t sqes_len;
+  /* queued in the submission ring but not yet handed to the kernel. */
+  unsigned unsubmitted;
+};
+#endif
+
+struct ace_io_batch {
+  char **paths;
+  int64_t count;
+  int64_t paths_capacity;
+  /* files [current, opened) have a slot, file i in slots[i % depth]. */
+  int64_t current;
+  int64_t opened;
+  int64_t depth;
+  int64_t chunk;
+  struct ace_io_slot *slots;
+  struct ace_line_reader *lines;
+  /* reads the kernel has yet to complete. */
+  int64_t in_flight;
+  int use_ring;
+#ifdef ACE_HAVE_IO_URING
+  struct ace_io_ring ring;
+#endif
+};
+
+#ifdef ACE_HAVE_IO_URING
+static int ring_open(struct ace_io_ring *ring, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd == -1) {
+    return -1;
+  }
+
+  size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_len = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+  int single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_map) {
+    sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+  }
+  char *sq = mmap(0, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQ_RING);
+  char *cq = single_map ? sq
+                        : mmap(0, cq_len, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd,
+                               IORING_OFF_CQ_RING);
+  size_t sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(0, sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    if (sq != MAP_FAILED) {
+      munmap(sq, sq_len);
+    }
+    if (!single_map && cq != MAP_FAILED) {
+      munmap(cq, cq_len);
+    }
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_len);
+    }
+    close(fd);
+    return -1;
+  }
+
+  ring->fd = fd;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->sqes = sqes;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  ring->sq_map = sq;
+  ring->sq_map_len = sq_len;
+  ring->cq_map = single_map ? 0 : cq;
+  ring->cq_map_len = cq_len;
+  ring->sqes_len = sqes_len;
+  ring->unsubmitted = 0;
+  return 0;
+}
+
+static void ring_close(struct ace_io_ring *ring) {
+  munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_map != 0) {
+    munmap(ring->cq_map, ring->cq_map_len);
+  }
+  munmap(ring->sq_map, ring->sq_map_len);
+  close(ring->fd);
+}
+
+/* hands what is queued to the kernel and, if wait is set, blocks until at
+ * least one request is complete. */
+static int ring_enter(struct ace_io_ring *ring, int wait) {
+  while (1) {
+    int ret = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted,
+                      wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+    if (ret >= 0) {
+      ring->unsubmitted -= ret;
+      return 0;
+    }
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+}
+
+static void queue_read(struct ace_io_batch *batch, int64_t index) {
+  struct ace_io_ring *ring = &batch->ring;
+  struct ace_io_slot *slot = &batch->slots[index];
+  /* there is never more than one read per slot in flight, and the ring has
+   * at least one entry per slot, so there is always room. */
+  unsigned tail = *ring->sq_tail;
+  unsigned entry = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[entry];
+  memset(sqe, 0, sizeof(*sqe));
+  slot->iov.iov_base = slot->buf;
+  slot->iov.iov_len = batch->chunk;
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = slot->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&slot->iov;
+  sqe->len = 1;
+  sqe->off = slot->offset;
+  sqe->user_data = index;
+  ring->sq_array[entry] = entry;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++ring->unsubmitted;
+  ++batch->in_flight;
+  slot->state = slot_reading;
+}
+
+static void reap(struct ace_io_batch *batch) {
+  struct ace_io_ring *ring = &batch->ring;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    struct ace_io_slot *slot = &batch->slots[cqe->user_data];
+    --batch->in_flight;
+    if (cqe->res > 0) {
+      slot->len = cqe->res;
+      slot->pos = 0;
+      slot->offset += cqe->res;
+      slot->state = slot_ready;
+    } else {
+      slot->err = -cqe->res;
+      slot->state = slot_done;
+    }
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* waits until the slot's read is complete. */
+static int await_slot(struct ace_io_batch *batch, struct ace_io_slot *slot) {
+  while (slot->state == slot_reading) {
+    if (ring_enter(&batch->ring, 1 /*wait*/) == -1) {
+      return -1;
+    }
+    reap(batch);
+  }
+  return 0;
+}
+#endif
+
+static struct ace_io_slot *current_slot(struct ace_io_batch *batch) {
+  return &batch->slots[batch->current % batch->depth];
+}
+
+static int64_t fill_lines(void *source, char *pb, int64_t cb) {
+  struct ace_io_batch *batch = source;
+  struct ace_io_slot *slot = current_slot(batch);
+  while (1) {
+    switch (slot->state) {
+    case slot_idle:
+      return ace_read(slot->fd, pb, cb);
+    case slot_done:
+      if (slot->err != 0) {
+        errno = slot->err;
+        return -1;
+      }
+      return 0;
+    case slot_ready: {
+      int64_t len = slot->len - slot->pos;
+      if (len > cb) {
+        len = cb;
+      }
+      memcpy(pb, slot->buf + slot->pos, len);
+      slot->pos += len;
+#ifdef ACE_HAVE_IO_URING
+      if (slot->pos == slot->len) {
+        /* read ahead while these lines are dealt with. */
+        queue_read(batch, batch->current % batch->depth);
+        ring_enter(&batch->ring, 0 /*wait*/);
+      }
+#endif
+      return len;
+    }
+    case slot_reading:
+#ifdef ACE_HAVE_IO_URING
+      if (await_slot(batch, slot) == -1) {
+        return -1;
+      }
+#endif
+      break;
+    }
+  }
+}
+
+#ifdef ACE_HAVE_IO_URING
+static int use_ring_by_default(void) {
+  const char *setting = getenv("ACE_IO_URING");
+  return setting == 0 || strcmp(setting, "0") != 0;
+}
+#endif
+
+/* depth is how many files may be open and in flight at once, and chunk how
+ * much is read from a file at a time. */
+struct ace_io_batch *ace_io_batch_new(int64_t depth, int64_t chunk) {
+  if (depth < 1) {
+    depth = 1;
+  } else if (depth > BATCH_MAX_DEPTH) {
+    depth = BATCH_MAX_DEPTH;
+  }
+  if (chunk < BATCH_MIN_CHUNK) {
+    chunk = BATCH_MIN_CHUNK;
+  }
+  /* the batch owns fds, malloc'd buffers and maybe a ring, so it can't live
+   * in an arena the caller has open. */
+  struct ace_io_batch *batch = ace_heap_malloc(sizeof(struct ace_io_batch));
+  batch->current = -1;
+  batch->depth = depth;
+  batch->chunk = chunk;
+#ifdef ACE_HAVE_IO_URING
+  batch->use_ring = use_ring_by_default() &&
+                    ring_open(&batch->ring, depth) == 0;
+#endif
+  if (!batch->use_ring) {
+    /* without read-ahead there is only ever the one file. */
+    batch->depth = 1;
+  }
+  batch->slots = calloc(batch->depth, sizeof(struct ace_io_slot));
+  for (int64_t i = 0; i < batch->depth; ++i) {
+    batch->slots[i].fd = -1;
+    batch->slots[i].state = slot_done;
+    if (batch->use_ring) {
+      batch->slots[i].buf = malloc(chunk);
+    }
+  }
+  batch->lines = ace_line_reader_from(batch, fill_lines, chunk);
+  return batch;
+}
+
+/* 1 when reads go through io_uring. */
+int64_t ace_io_batch_uses_ring(const struct ace_io_batch *batch) {
+  return batch->use_ring;
+}
+
+/* queues path to be read after those added before it. */
+int64_t ace_io_batch_add(struct ace_io_batch *batch, const char *path) {
+  if (batch->count == batch->paths_capacity) {
+    int64_t capacity = batch->paths_capacity > 0 ? batch->paths_capacity * 2
+                                                 : 64;
+    char **paths = realloc(batch->paths, capacity * sizeof(char *));
+    if (paths == 0) {
+      return -1;
+    }
+    batch->paths = paths;
+    batch->paths_capacity = capacity;
+  }
+  batch->paths[batch->count++] = strdup(path);
+  return 0;
+}
+
+static void release_slot(struct ace_io_batch *batch, struct ace_io_slot *slot) {
+#ifdef ACE_HAVE_IO_URING
+  /* the kernel may still be reading ahead into the buffer. */
+  if (batch->use_ring) {
+    await_slot(batch, slot);
+  }
+#else
+  (void)batch;
+#endif
+  if (slot->fd != -1) {
+    ace_close(slot->fd);
+    slot->fd = -1;
+  }
+  slot->state = slot_done;
+}
+
+/* opens the files that fit in the window, and requests a first chunk of
+ * each, all in one submission. */
+static void fill_window(struct ace_io_batch *batch) {
+  while (batch->opened < batch->count &&
+         batch->opened < batch->current + batch->depth) {
+    int64_t index = batch->opened % batch->depth;
+    struct ace_io_slot *slot = &batch->slots[index];
+    slot->fd = ace_open(batch->paths[batch->opened], O_RDONLY | O_CLOEXEC, 0);
+    slot->err = slot->fd == -1 ? errno : 0;
+    slot->state = slot->fd == -1 ? slot_done : slot_idle;
+    slot->len = slot->pos = slot->offset = 0;
+#ifdef ACE_HAVE_IO_URING
+    if (batch->use_ring && slot->fd != -1) {
+      queue_read(batch, index);
+    }
+#endif
+    ++batch->opened;
+  }
+#ifdef ACE_HAVE_IO_URING
+  if (batch->use_ring && batch->ring.unsubmitted > 0) {
+    ring_enter(&batch->ring, 0 /*wait*/);
+  }
+#endif
+}
+
+/* moves on to the next file, returning its index, or -1 once every file has
+ * been read. */
+int64_t ace_io_batch_next(struct ace_io_batch *batch) {
+  if (batch->current >= batch->count) {
+    return -1;
+  }
+  if (batch->current >= 0) {
+    release_slot(batch, current_slot(batch));
+  }
+  ++batch->current;
+  if (batch->current == batch->count) {
+    return -1;
+  }
+  fill_window(batch);
+  ace_line_reader_restart(batch->lines);
+  return batch->current;
+}
+
+/* the errno that opening or reading the current file failed with, or 0.
+ * reads may fail later, so this is only settled once its lines run out. */
+int64_t ace_io_batch_errno(struct ace_io_batch *batch) {
+  return current_slot(batch)->err;
+}
+
+/* the line reader for the current file; it starts over with each file. */
+struct ace_line_reader *ace_io_batch_lines(struct ace_io_batch *batch) {
+  return batch->lines;
+}
+
+int64_t ace_io_batch_close(struct ace_io_batch *batch) {
+  for (int64_t i = 0; i < batch->depth; ++i) {
+    release_slot(batch, &batch->slots[i]);
+    free(batch->slots[i].buf);
+  }
+#ifdef ACE_HAVE_IO_URING
+  if (batch->use_ring) {
+    ring_close(&batch->ring);
+  }
+#endif
+  for (int64_t i = 0; i < batch->count; ++i) {
+    free(batch->paths[i]);
+  }
+  free(batch->paths);
+  free(batch->slots);
+  batch->paths = 0;
+  batch->slots = 0;
+  batch->count = 0;
+  return 0;
+}
@@ -0,0 +1,289 @@
+/* The event loop behind lib/event.ace.
+ *
+ * A loop watches file descriptors and calls an Ace closure (a fn () ()) when
+ * one turns readable or writable. Watches are level-triggered and last until
+ * they are dropped, so a callback that leaves data unread is just called
+ * again, and callbacks should expect the odd EAGAIN. Linux uses epoll;
+ * elsewhere the same loop runs on poll(2).
+ *
+ * The callbacks sit in a table indexed by fd that is allocated from the
+ * collector and hangs off the loop, so a closure stays alive for as long as
+ * it is registered. ace_event_loop_stop may be called from any thread: it
+ * writes to a pipe the loop always watches. */
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+void *ace_heap_malloc(uint64_t cb);
+void *ace_heap_malloc_atomic(uint64_t cb);
+
+typedef void *(*ace_thunk_fn)(void *unit, void *closure);
+
+#define EVENT_BATCH 256
+#define EVENT_MIN_WATCHES 64
+
+enum { watch_readable = 0, watch_writable = 1 };
+
+struct ace_watch {
+  /* the callbacks, indexed by watch_readable and watch_writable. */
+  void *callbacks[2];
+};
+
+struct ace_event_loop {
+  /* the epoll instance, or -1 under poll(2). */
+  int64_t poll_fd;
+  int wake[2];
+  struct ace_watch *watches;
+  int64_t capacity;
+  /* how many fds have at least one callback. */
+  int64_t watching;
+  atomic_int stopping;
+};
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags == -1 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void call(void *closure) {
+  (*(ace_thunk_fn *)closure)(0, closure);
+}
+
+/* returns NULL with errno set on failure. */
+struct ace_event_loop *ace_event_loop_new(void) {
+  /* the loop outlives any arena its callbacks open, so it is never in one. */
+  struct ace_event_loop *loop = ace_heap_malloc(sizeof(struct ace_event_loop));
+  loop->poll_fd = -1;
+  if (pipe(loop->wake) == -1) {
+    return 0;
+  }
+  set_nonblocking(loop->wake[0]);
+  set_nonblocking(loop->wake[1]);
+  fcntl(loop->wake[0], F_SETFD, FD_CLOEXEC);
+  fcntl(loop->wake[1], F_SETFD, FD_CLOEXEC);
+#ifdef __linux__
+  loop->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {.events = EPOLLIN, .data.fd = loop->wake[0]};
+  if (loop->poll_fd == -1 ||
+      epoll_ctl(loop->poll_fd, EPOLL_CTL_ADD, loop->wake[0], &event) == -1) {
+    int saved_errno = errno;
+    if (loop->poll_fd != -1) {
+      close(loop->poll_fd);
+    }
+    close(loop->wake[0]);
+    close(loop->wake[1]);
+    errno = saved_errno;
+    return 0;
+  }
+#endif
+  return loop;
+}
+
+/* the fds being watched are left open; only the loop's own are closed. */
+int64_t ace_event_loop_close(struct ace_event_loop *loop) {
+  if (loop->poll_fd != -1) {
+    close(loop->poll_fd);
+  }
+  close(loop->wake[0]);
+  close(loop->wake[1]);
+  return 0;
+}
+
+static int interest(const struct ace_watch *watch) {
+  return (watch->callbacks[watch_readable] != 0 ? 1 : 0) |
+         (watch->callbacks[watch_writable] != 0 ? 2 : 0);
+}
+
+static int update(struct ace_event_loop *loop,
+                  int64_t fd,
+                  int before,
+                  int after) {
+  if (before == after) {
+    return 0;
+  }
+  if (before == 0) {
+    ++loop->watching;
+  } else if (after == 0) {
+    --loop->watching;
+  }
+#ifdef __linux__
+  struct epoll_event event = {
+      .events = ((after & 1) ? EPOLLIN : 0) | ((after & 2) ? EPOLLOUT : 0),
+      .data.fd = fd,
+  };
+  int op = before == 0  ? EPOLL_CTL_ADD
+           : after == 0 ? EPOLL_CTL_DEL
+                        : EPOLL_CTL_MOD;
+  if (epoll_ctl(loop->poll_fd, op, fd, &event) == -1) {
+    if (op == EPOLL_CTL_DEL) {
+      /* the fd was closed first, and epoll has already let go of it. */
+      return 0;
+    }
+    if (before == 0) {
+      --loop->watching;
+    }
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+/* calls closure whenever fd is ready for the kind of io given (0 for reads,
+ * 1 for writes), in place of any callback it had for that before. */
+int64_t ace_event_set(struct ace_event_loop *loop,
+                      int64_t fd,
+                      int64_t kind,
+                      void *closure) {
+  if (fd < 0 || (kind != watch_readable && kind != watch_writable)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (fd >= loop->capacity) {
+    int64_t capacity = loop->capacity > 0 ? loop->capacity : EVENT_MIN_WATCHES;
+    while (capacity <= fd) {
+      capacity *= 2;
+    }
+    /* the table lasts as long as the loop, whatever arena a callback that
+     * gets here has open. */
+    struct ace_watch *watches = ace_heap_malloc(capacity *
+                                                sizeof(struct ace_watch));
+    if (loop->capacity > 0) {
+      memcpy(watches, loop->watches, loop->capacity * sizeof(struct ace_watch));
+    }
+    loop->watches = watches;
+    loop->capacity = capacity;
+  }
+
+  struct ace_watch *watch = &loop->watches[fd];
+  int before = interest(watch);
+  void *previous = watch->callbacks[kind];
+  watch->callbacks[kind] = closure;
+  if (update(loop, fd, before, interest(watch)) == -1) {
+    watch->callbacks[kind] = previous;
+    return -1;
+  }
+  return 0;
+}
+
+int64_t ace_event_clear(struct ace_event_loop *loop, int64_t fd, int64_t kind) {
+  if (fd < 0 || fd >= loop->capacity ||
+      (kind != watch_readable && kind != watch_writable)) {
+    return 0;
+  }
+  struct ace_watch *watch = &loop->watches[fd];
+  int before = interest(watch);
+  watch->callbacks[kind] = 0;
+  return update(loop, fd, before, interest(watch));
+}
+
+/* drops every callback for fd. do this before closing it, or the next fd to
+ * get its number inherits them. */
+int64_t ace_event_forget(struct ace_event_loop *loop, int64_t fd) {
+  ace_event_clear(loop, fd, watch_readable);
+  return ace_event_clear(loop, fd, watch_writable);
+}
+
+/* makes ace_event_loop_run return after the callbacks it is running now. */
+int64_t ace_event_loop_stop(struct ace_event_loop *loop) {
+  atomic_store(&loop->stopping, 1);
+  char byte = 0;
+  /* if the pipe is full, the loop is already due to wake. */
+  (void)!write(loop->wake[1], &byte, 1);
+  return 0;
+}
+
+static void dispatch(struct ace_event_loop *loop,
+                     int64_t fd,
+                     int readable,
+                     int writable) {
+  /* look the callbacks up afresh each time, since any callback may have
+   * changed them. */
+  if (readable && fd < loop->capacity &&
+      loop->watches[fd].callbacks[watch_readable] != 0) {
+    call(loop->watches[fd].callbacks[watch_readable]);
+  }
+  if (writable && fd < loop->capacity &&
+      loop->watches[fd].callbacks[watch_writable] != 0) {
+    call(loop->watches[fd].callbacks[watch_writable]);
+  }
+}
+
+static void drain_wake(struct ace_event_loop *loop) {
+  char buf[64];
+  while (read(loop->wake[0], buf, sizeof(buf)) > 0) {
+  }
+}
+
+#ifdef __linux__
+static int64_t wait_and_dispatch(struct ace_event_loop *loop) {
+  struct epoll_event events[EVENT_BATCH];
+  int count = epoll_wait(loop->poll_fd, events, EVENT_BATCH, -1);
+  if (count == -1) {
+    return errno == EINTR ? 0 : -1;
+  }
+  for (int i = 0; i < count; ++i) {
+    int fd = events[i].data.fd;
+    if (fd == loop->wake[0]) {
+      drain_wake(loop);
+      continue;
+    }
+    /* hangups and errors go to whichever callbacks there are, so that a
+     * read sees the end of the stream and a connect sees its failure. */
+    uint32_t ready = events[i].events;
+    int broken = (ready & (EPOLLHUP | EPOLLERR)) != 0;
+    dispatch(loop, fd, broken || (ready & EPOLLIN), broken || (ready & EPOLLOUT));
+  }
+  return 0;
+}
+#else
+static int64_t wait_and_dispatch(struct ace_event_loop *loop) {
+  int64_t capacity = loop->watching + 1;
+  struct pollfd *pollfds = ace_heap_malloc_atomic(capacity *
+                                                  sizeof(struct pollfd));
+  int64_t count = 0;
+  pollfds[count++] = (struct pollfd){.fd = loop->wake[0], .events = POLLIN};
+  for (int64_t fd = 0; fd < loop->capacity && count < capacity; ++fd) {
+    int wanted = interest(&loop->watches[fd]);
+    if (wanted != 0) {
+      pollfds[count++] = (struct pollfd){
+          .fd = fd,
+          .events = ((wanted & 1) ? POLLIN : 0) | ((wanted & 2) ? POLLOUT : 0),
+      };
+    }
+  }
+  if (poll(pollfds, count, -1) == -1) {
+    return errno == EINTR ? 0 : -1;
+  }
+  if (pollfds[0].revents != 0) {
+    drain_wake(loop);
+  }
+  for (int64_t i = 1; i < count; ++i) {
+    short ready = pollfds[i].revents;
+    int broken = (ready & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+    if (ready != 0) {
+      dispatch(loop, pollfds[i].fd, broken || (ready & POLLIN),
+               broken || (ready & POLLOUT));
+    }
+  }
+  return 0;
+}
+#endif
+
+/* calls callbacks until nothing is watched any more or the loop is stopped.
+ * returns 0, or -1 with errno set if waiting failed. */
+int64_t ace_event_loop_run(struct ace_event_loop *loop) {
+  int64_t ret = 0;
+  while (ret == 0 && loop->watching > 0 && !atomic_load(&loop->stopping)) {
+    ret = wait_and_dispatch(loop);
+  }
+  atomic_store(&loop->stopping, 0);
+  return ret;
+}
@@ -0,0 +1,154 @@
+/* Non-cryptographic hashing for lib/hash.ace.
+ *
+ * Byte strings go through a wyhash-style function: 64x64->128 bit multiplies
+ * folded back into 64 bits, reading 16 or 48 bytes per round. Ints go through
+ * a bijective multiply-xorshift mixer, so two distinct Ints can only collide
+ * in the sign bit that is masked off at the end.
+ *
+ * Every hash is keyed by ace_hash_seed. It is 0 unless ACE_HASH_SEED is set at
+ * startup, either to a number or to "random" to draw a key from the OS, which
+ * makes the hashes of adversarial keys unpredictable. The results are not
+ * suitable for anything cryptographic. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+static const uint64_t secret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                   0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+static uint64_t ace_hash_seed = 0;
+
+__attribute__((constructor)) static void ace_hash_init_seed(void) {
+  const char *seed = getenv("ACE_HASH_SEED");
+  if (seed == 0 || *seed == 0) {
+    return;
+  }
+  if (strcmp(seed, "random") == 0) {
+#if defined(__linux__)
+    if (getrandom(&ace_hash_seed, sizeof(ace_hash_seed), 0) ==
+        sizeof(ace_hash_seed)) {
+      return;
+    }
+#else
+    arc4random_buf(&ace_hash_seed, sizeof(ace_hash_seed));
+    return;
+#endif
+  }
+  ace_hash_seed = strtoull(seed, 0, 0);
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t hash_bytes(const uint8_t *p, uint64_t len, uint64_t seed) {
+  uint64_t a, b;
+  seed ^= wymix(seed ^ secret[0], secret[1]);
+  if (len <= 16) {
+    if (len >= 4) {
+      uint64_t mid = (len >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + mid);
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    uint64_t i = len;
+    if (i > 48) {
+      /* three independent lanes keep the multipliers busy */
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = wymix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+        seed1 = wymix(read64(p + 16) ^ secret[2], read64(p + 24) ^ seed1);
+        seed2 = wymix(read64(p + 32) ^ secret[3], read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = wymix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+
+  __uint128_t r = (__uint128_t)(a ^ secret[1]) * (b ^ seed);
+  return wymix((uint64_t)r ^ secret[0] ^ len, (uint64_t)(r >> 64) ^ secret[1]);
+}
+
+static inline uint64_t mix_int(uint64_t x) {
+  x ^= x >> 27;
+  x *= 0x3c79ac492ba7b653ULL;
+  x ^= x >> 33;
+  x *= 0x1c69b3f74ac4ae35ULL;
+  x ^= x >> 27;
+  return x;
+}
+
+/* the hashes handed back to Ace are never negative. */
+int64_t ace_hash(const uint8_t *input, int64_t len) {
+  return hash_bytes(input, len, ace_hash_seed) & INT64_MAX;
+}
+
+int64_t ace_hash_keyed(const uint8_t *input, int64_t len, int64_t key) {
+  return hash_bytes(input, len, ace_hash_seed ^ (uint64_t)key) & INT64_MAX;
+}
+
+int64_t ace_hash_int(int64_t x) {
+  return mix_int((uint64_t)x ^ ace_hash_seed ^ secret[0]) & INT64_MAX;
+}
+
+int64_t ace_hash_int_keyed(int64_t x, int64_t key) {
+  return mix_int((uint64_t)x ^ ace_hash_seed ^ (uint64_t)key ^ secret[0]) &
+         INT64_MAX;
+}
+
+int64_t ace_hash_combine(int64_t seed, int64_t value) {
+  return wymix((uint64_t)seed ^ secret[0], (uint64_t)value ^ secret[1]) &
+         INT64_MAX;
+}
+
+/* hashes count Ints at once. the four lanes have no dependencies on each
+ * other, so the multiplies overlap (or become vector multiplies where the
+ * target has 64-bit lanes), and only the final fold is serial. */
+int64_t ace_hash_ints(const int64_t *values, int64_t count) {
+  uint64_t lanes[4] = {ace_hash_seed ^ secret[0], ace_hash_seed ^ secret[1],
+                       ace_hash_seed ^ secret[2], ace_hash_seed ^ secret[3]};
+  int64_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    for (int lane = 0; lane < 4; ++lane) {
+      uint64_t x = (lanes[lane] ^ (uint64_t)values[i + lane]) *
+                   0x9e3779b97f4a7c15ULL;
+      lanes[lane] = x ^ (x >> 29);
+    }
+  }
+  for (; i < count; ++i) {
+    uint64_t x = (lanes[0] ^ (uint64_t)values[i]) * 0x9e3779b97f4a7c15ULL;
+    lanes[0] = x ^ (x >> 29);
+  }
+  return wymix(wymix(lanes[0], lanes[1]) ^ (uint64_t)count,
+               wymix(lanes[2], lanes[3])) &
+         INT64_MAX;
+}
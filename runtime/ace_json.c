@@ -0,0 +1,620 @@
+/* Streaming JSON for lib/json.ace.
+ *
+ * Parsing happens in two stages, after simdjson. Stage 1 classifies the input
+ * 64 bytes at a time into bitmasks (with SSE2 where available): quotes,
+ * backslashes, whitespace and the structural characters {}[]:,. Quotes that
+ * follow an odd run of backslashes are escaped; a prefix XOR over the rest
+ * marks which bytes are inside strings. What survives is an index of every
+ * structural character, every unescaped quote, and the first byte of every
+ * number, true, false and null.
+ *
+ * Stage 2 is a pull parser that walks that index one event at a time, so the
+ * caller can build a tree, decode straight into its own types, or skip whole
+ * values without ever looking at their bytes. Strings without escapes are
+ * handed back as views into the input; only strings with escapes are copied
+ * (and decoded). */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void *ace_malloc_atomic(uint64_t cb);
+void *ace_heap_malloc(uint64_t cb);
+void *ace_heap_malloc_atomic(uint64_t cb);
+
+/* lib/json.ace turns these into JsonEvents by value. */
+enum json_event {
+  JSON_BEGIN_OBJECT,
+  JSON_END_OBJECT,
+  JSON_BEGIN_ARRAY,
+  JSON_END_ARRAY,
+  JSON_KEY,
+  JSON_STRING,
+  JSON_NUMBER,
+  JSON_TRUE,
+  JSON_FALSE,
+  JSON_NULL,
+  JSON_END,
+  JSON_ERROR,
+};
+
+enum json_state {
+  /* a value must come next. */
+  JSON_EXPECT_VALUE,
+  /* just after '[': a value or ']'. */
+  JSON_EXPECT_VALUE_OR_END,
+  /* just after '{': a key or '}'. */
+  JSON_EXPECT_KEY_OR_END,
+  /* just after ',' in an object. */
+  JSON_EXPECT_KEY,
+  /* just after a value in a container. */
+  JSON_EXPECT_COMMA_OR_END,
+  /* the top-level value is complete. */
+  JSON_EXPECT_EOF,
+};
+
+struct ace_json_reader {
+  const char *input;
+  int64_t len;
+  uint32_t *index;
+  int64_t index_count;
+  int64_t next;
+
+  /* the stack of open containers, as '{' and '['. */
+  char *stack;
+  int64_t depth;
+  int64_t stack_capacity;
+  enum json_state state;
+
+  /* the current event and its payload. */
+  int64_t event;
+  const char *str;
+  int64_t str_len;
+  double number;
+  int64_t error_offset;
+  int64_t peeked;
+};
+
+/* stage 1 */
+
+struct json_block {
+  uint64_t op;
+  uint64_t whitespace;
+  uint64_t quote;
+  uint64_t backslash;
+};
+
+#ifdef __SSE2__
+static inline uint64_t eq_mask(__m128i v, char c) {
+  return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+#endif
+
+static inline void classify(const char *p, struct json_block *block) {
+#ifdef __SSE2__
+  block->op = block->whitespace = block->quote = block->backslash = 0;
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+    int shift = i * 16;
+    block->op |= (eq_mask(v, '{') | eq_mask(v, '}') | eq_mask(v, '[') |
+                  eq_mask(v, ']') | eq_mask(v, ':') | eq_mask(v, ','))
+                 << shift;
+    block->whitespace |= (eq_mask(v, ' ') | eq_mask(v, '\t') |
+                          eq_mask(v, '\n') | eq_mask(v, '\r'))
+                         << shift;
+    block->quote |= eq_mask(v, '"') << shift;
+    block->backslash |= eq_mask(v, '\\') << shift;
+  }
+#else
+  block->op = block->whitespace = block->quote = block->backslash = 0;
+  for (int i = 0; i < 64; ++i) {
+    uint64_t bit = (uint64_t)1 << i;
+    switch (p[i]) {
+    case '{': case '}': case '[': case ']': case ':': case ',':
+      block->op |= bit;
+      break;
+    case ' ': case '\t': case '\n': case '\r':
+      block->whitespace |= bit;
+      break;
+    case '"':
+      block->quote |= bit;
+      break;
+    case '\\':
+      block->backslash |= bit;
+      break;
+    }
+  }
+#endif
+}
+
+/* the bytes that follow an odd-length run of backslashes, which are the ones
+ * that are escaped. *carry says whether the previous block ended in one. */
+static inline uint64_t find_escaped(uint64_t backslash, uint64_t *carry) {
+  const uint64_t even_bits = 0x5555555555555555ULL;
+  const uint64_t odd_bits = ~even_bits;
+  uint64_t start_edges = backslash & ~(backslash << 1);
+  uint64_t even_start_mask = even_bits ^ *carry;
+  uint64_t even_starts = start_edges & even_start_mask;
+  uint64_t odd_starts = start_edges & ~even_start_mask;
+  uint64_t even_carries = backslash + even_starts;
+  uint64_t odd_carries;
+  int ends_odd = __builtin_add_overflow(backslash, odd_starts, &odd_carries);
+  odd_carries |= *carry;
+  *carry = ends_odd ? 1 : 0;
+  uint64_t even_carry_ends = even_carries & ~backslash;
+  uint64_t odd_carry_ends = odd_carries & ~backslash;
+  return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+}
+
+/* bit i is the XOR of bits 0..i. */
+static inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/* returns the number of positions written to index, which needs room for
+ * len + 1 of them. */
+static int64_t build_index(const char *input, int64_t len, uint32_t *index) {
+  uint64_t escape_carry = 0;
+  /* all ones while inside a string across a block boundary. */
+  uint64_t in_string_carry = 0;
+  uint64_t scalar_carry = 0;
+  int64_t count = 0;
+  char tail[64];
+
+  for (int64_t base = 0; base < len; base += 64) {
+    const char *p = input + base;
+    if (len - base < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, len - base);
+      p = tail;
+    }
+
+    struct json_block block;
+    classify(p, &block);
+    uint64_t escaped = find_escaped(block.backslash, &escape_carry);
+    uint64_t quote = block.quote & ~escaped;
+    /* set on opening quotes and string contents, clear on closing quotes. */
+    uint64_t in_string = prefix_xor(quote) ^ in_string_carry;
+    in_string_carry = (uint64_t)((int64_t)in_string >> 63);
+
+    uint64_t scalar = ~(block.op | block.whitespace | quote) & ~in_string;
+    uint64_t scalar_starts = scalar & ~((scalar << 1) | scalar_carry);
+    scalar_carry = scalar >> 63;
+
+    uint64_t bits = (block.op & ~in_string) | quote | scalar_starts;
+    while (bits != 0) {
+      index[count++] = (uint32_t)(base + __builtin_ctzll(bits));
+      bits &= bits - 1;
+    }
+  }
+  return count;
+}
+
+/* stage 2 */
+
+static inline int is_delimiter(char c) {
+  switch (c) {
+  case '{': case '}': case '[': case ']': case ':': case ',':
+  case ' ': case '\t': case '\n': case '\r': case '"':
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static int64_t fail(struct ace_json_reader *reader, int64_t offset) {
+  reader->event = JSON_ERROR;
+  reader->error_offset = offset;
+  reader->next = reader->index_count;
+  reader->depth = 0;
+  reader->state = JSON_EXPECT_EOF;
+  return JSON_ERROR;
+}
+
+static int64_t next_position(struct ace_json_reader *reader) {
+  return reader->next < reader->index_count ? reader->index[reader->next++]
+                                            : reader->len;
+}
+
+static void push(struct ace_json_reader *reader, char container) {
+  if (reader->depth == reader->stack_capacity) {
+    int64_t capacity = reader->stack_capacity * 2;
+    /* the reader may be older than the arena this runs in, if any. */
+    char *stack = ace_heap_malloc_atomic(capacity);
+    memcpy(stack, reader->stack, reader->depth);
+    reader->stack = stack;
+    reader->stack_capacity = capacity;
+  }
+  reader->stack[reader->depth++] = container;
+}
+
+static void after_value(struct ace_json_reader *reader) {
+  reader->state =
+      reader->depth != 0 ? JSON_EXPECT_COMMA_OR_END : JSON_EXPECT_EOF;
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static int read_hex4(const char *p, const char *end, uint32_t *value) {
+  if (end - p < 4) {
+    return 0;
+  }
+  *value = 0;
+  for (int i = 0; i < 4; ++i) {
+    int digit = hex_digit(p[i]);
+    if (digit < 0) {
+      return 0;
+    }
+    *value = (*value << 4) | digit;
+  }
+  return 1;
+}
+
+static char *put_utf8(char *out, uint32_t cp) {
+  if (cp < 0x80) {
+    *out++ = (char)cp;
+  } else if (cp < 0x800) {
+    *out++ = (char)(0xc0 | (cp >> 6));
+    *out++ = (char)(0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    *out++ = (char)(0xe0 | (cp >> 12));
+    *out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (cp & 0x3f));
+  } else {
+    *out++ = (char)(0xf0 | (cp >> 18));
+    *out++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+    *out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+    *out++ = (char)(0x80 | (cp & 0x3f));
+  }
+  return out;
+}
+
+/* decodes the escapes in [p, end) into a fresh buffer. the output is never
+ * longer than the input, since every escape is at least as long as the UTF-8
+ * it stands for. */
+static int unescape(struct ace_json_reader *reader, const char *p,
+                    const char *end) {
+  char *out = ace_malloc_atomic(end - p + 1);
+  char *start = out;
+  while (p < end) {
+    const char *backslash = memchr(p, '\\', end - p);
+    if (backslash == 0) {
+      memcpy(out, p, end - p);
+      out += end - p;
+      break;
+    }
+    memcpy(out, p, backslash - p);
+    out += backslash - p;
+    p = backslash + 1;
+    switch (*p++) {
+    case '"': *out++ = '"'; break;
+    case '\\': *out++ = '\\'; break;
+    case '/': *out++ = '/'; break;
+    case 'b': *out++ = '\b'; break;
+    case 'f': *out++ = '\f'; break;
+    case 'n': *out++ = '\n'; break;
+    case 'r': *out++ = '\r'; break;
+    case 't': *out++ = '\t'; break;
+    case 'u': {
+      uint32_t cp;
+      if (!read_hex4(p, end, &cp)) {
+        return 0;
+      }
+      p += 4;
+      if (cp >= 0xd800 && cp < 0xdc00) {
+        uint32_t low;
+        if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+            !read_hex4(p + 2, end, &low) || low < 0xdc00 || low >= 0xe000) {
+          return 0;
+        }
+        p += 6;
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+      } else if (cp >= 0xdc00 && cp < 0xe000) {
+        return 0;
+      }
+      out = put_utf8(out, cp);
+      break;
+    }
+    default:
+      return 0;
+    }
+  }
+  reader->str = start;
+  reader->str_len = out - start;
+  return 1;
+}
+
+static int64_t read_string(struct ace_json_reader *reader, int64_t open,
+                           int64_t event) {
+  int64_t close = next_position(reader);
+  if (close >= reader->len || reader->input[close] != '"') {
+    return fail(reader, open);
+  }
+  const char *p = reader->input + open + 1;
+  const char *end = reader->input + close;
+  if (memchr(p, '\\', end - p) == 0) {
+    reader->str = p;
+    reader->str_len = end - p;
+  } else if (!unescape(reader, p, end)) {
+    return fail(reader, open);
+  }
+  reader->event = event;
+  return event;
+}
+
+/* checks the JSON number grammar: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)? */
+static int is_number(const char *p, const char *end) {
+  if (p < end && *p == '-') {
+    ++p;
+  }
+  if (p == end) {
+    return 0;
+  }
+  if (*p == '0') {
+    ++p;
+  } else if (*p >= '1' && *p <= '9') {
+    while (p < end && *p >= '0' && *p <= '9') {
+      ++p;
+    }
+  } else {
+    return 0;
+  }
+  if (p < end && *p == '.') {
+    const char *digits = ++p;
+    while (p < end && *p >= '0' && *p <= '9') {
+      ++p;
+    }
+    if (p == digits) {
+      return 0;
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    if (p < end && (*p == '+' || *p == '-')) {
+      ++p;
+    }
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+      ++p;
+    }
+    if (p == digits) {
+      return 0;
+    }
+  }
+  return p == end;
+}
+
+static double parse_number(const char *p, int64_t len) {
+  /* integers that fit in a double's mantissa are exact without strtod. */
+  if (len <= 15) {
+    int negative = *p == '-';
+    int64_t value = 0;
+    int64_t i = negative;
+    for (; i < len && p[i] >= '0' && p[i] <= '9'; ++i) {
+      value = value * 10 + (p[i] - '0');
+    }
+    if (i == len) {
+      return negative ? -(double)value : (double)value;
+    }
+  }
+  char buffer[64];
+  char *sz = len < (int64_t)sizeof(buffer) ? buffer : malloc(len + 1);
+  memcpy(sz, p, len);
+  sz[len] = 0;
+  double value = strtod(sz, 0);
+  if (sz != buffer) {
+    free(sz);
+  }
+  return value;
+}
+
+static int64_t read_scalar(struct ace_json_reader *reader, int64_t start) {
+  const char *p = reader->input + start;
+  const char *end = p;
+  const char *input_end = reader->input + reader->len;
+  while (end < input_end && !is_delimiter(*end)) {
+    ++end;
+  }
+  int64_t len = end - p;
+  if (len == 4 && memcmp(p, "true", 4) == 0) {
+    reader->event = JSON_TRUE;
+  } else if (len == 5 && memcmp(p, "false", 5) == 0) {
+    reader->event = JSON_FALSE;
+  } else if (len == 4 && memcmp(p, "null", 4) == 0) {
+    reader->event = JSON_NULL;
+  } else if (is_number(p, end)) {
+    reader->number = parse_number(p, len);
+    reader->event = JSON_NUMBER;
+  } else {
+    return fail(reader, start);
+  }
+  return reader->event;
+}
+
+static int64_t read_value(struct ace_json_reader *reader, int64_t position) {
+  if (position >= reader->len) {
+    return fail(reader, position);
+  }
+  switch (reader->input[position]) {
+  case '{':
+    push(reader, '{');
+    reader->state = JSON_EXPECT_KEY_OR_END;
+    return reader->event = JSON_BEGIN_OBJECT;
+  case '[':
+    push(reader, '[');
+    reader->state = JSON_EXPECT_VALUE_OR_END;
+    return reader->event = JSON_BEGIN_ARRAY;
+  case '"':
+    after_value(reader);
+    return read_string(reader, position, JSON_STRING);
+  case '}': case ']': case ':': case ',':
+    return fail(reader, position);
+  default:
+    after_value(reader);
+    return read_scalar(reader, position);
+  }
+}
+
+static int64_t read_key(struct ace_json_reader *reader, int64_t position) {
+  if (position >= reader->len || reader->input[position] != '"' ||
+      read_string(reader, position, JSON_KEY) == JSON_ERROR) {
+    return fail(reader, position);
+  }
+  int64_t colon = next_position(reader);
+  if (colon >= reader->len || reader->input[colon] != ':') {
+    return fail(reader, colon);
+  }
+  reader->state = JSON_EXPECT_VALUE;
+  return JSON_KEY;
+}
+
+static int64_t close_container(struct ace_json_reader *reader,
+                               int64_t position, char container,
+                               int64_t event) {
+  if (reader->depth == 0 || reader->stack[reader->depth - 1] != container) {
+    return fail(reader, position);
+  }
+  --reader->depth;
+  after_value(reader);
+  return reader->event = event;
+}
+
+static int64_t advance(struct ace_json_reader *reader) {
+  if (reader->event == JSON_ERROR || reader->event == JSON_END) {
+    return reader->event;
+  }
+  int64_t position = next_position(reader);
+  char c = position < reader->len ? reader->input[position] : 0;
+  switch (reader->state) {
+  case JSON_EXPECT_VALUE:
+    return read_value(reader, position);
+  case JSON_EXPECT_VALUE_OR_END:
+    if (c == ']') {
+      return close_container(reader, position, '[', JSON_END_ARRAY);
+    }
+    return read_value(reader, position);
+  case JSON_EXPECT_KEY_OR_END:
+    if (c == '}') {
+      return close_container(reader, position, '{', JSON_END_OBJECT);
+    }
+    return read_key(reader, position);
+  case JSON_EXPECT_KEY:
+    return read_key(reader, position);
+  case JSON_EXPECT_COMMA_OR_END: {
+    char container = reader->stack[reader->depth - 1];
+    if (c == ',') {
+      position = next_position(reader);
+      return container == '{' ? read_key(reader, position)
+                              : read_value(reader, position);
+    } else if (c == '}' && container == '{') {
+      return close_container(reader, position, '{', JSON_END_OBJECT);
+    } else if (c == ']' && container == '[') {
+      return close_container(reader, position, '[', JSON_END_ARRAY);
+    }
+    return fail(reader, position);
+  }
+  case JSON_EXPECT_EOF:
+    if (position < reader->len) {
+      return fail(reader, position);
+    }
+    return reader->event = JSON_END;
+  }
+  return fail(reader, position);
+}
+
+/* the API used by lib/json.ace */
+
+struct ace_json_reader *ace_json_reader_new(const char *input, int64_t len) {
+  /* a reader may be made before an arena opens and read inside it, so it and
+   * its stack and index come from the heap. the strings it decodes are the
+   * caller's, and come from wherever the caller allocates. */
+  struct ace_json_reader *reader = ace_heap_malloc(
+      sizeof(struct ace_json_reader));
+  reader->input = input;
+  reader->len = len;
+  reader->stack_capacity = 16;
+  reader->stack = ace_heap_malloc_atomic(reader->stack_capacity);
+  reader->state = JSON_EXPECT_VALUE;
+  /* any event other than END or ERROR, so that advance gets going. */
+  reader->event = JSON_NULL;
+  if (len > UINT32_MAX) {
+    fail(reader, UINT32_MAX);
+    return reader;
+  }
+  reader->index = ace_heap_malloc_atomic(sizeof(uint32_t) * (len + 1));
+  reader->index_count = build_index(input, len, reader->index);
+  return reader;
+}
+
+int64_t ace_json_next(struct ace_json_reader *reader) {
+  if (reader->peeked) {
+    reader->peeked = 0;
+    return reader->event;
+  }
+  return advance(reader);
+}
+
+int64_t ace_json_peek(struct ace_json_reader *reader) {
+  if (!reader->peeked) {
+    ace_json_next(reader);
+    reader->peeked = 1;
+  }
+  return reader->event;
+}
+
+/* consumes the next value, however deeply nested, without decoding it.
+ * returns 0 if the input turned out to be malformed. */
+int64_t ace_json_skip(struct ace_json_reader *reader) {
+  int64_t depth = 0;
+  do {
+    switch (ace_json_next(reader)) {
+    case JSON_BEGIN_OBJECT:
+    case JSON_BEGIN_ARRAY:
+      ++depth;
+      break;
+    case JSON_END_OBJECT:
+    case JSON_END_ARRAY:
+      --depth;
+      break;
+    case JSON_KEY:
+      break;
+    case JSON_END:
+    case JSON_ERROR:
+      return 0;
+    }
+  } while (depth > 0);
+  return depth == 0;
+}
+
+const char *ace_json_string(const struct ace_json_reader *reader) {
+  return reader->str;
+}
+
+int64_t ace_json_string_len(const struct ace_json_reader *reader) {
+  return reader->str_len;
+}
+
+double ace_json_number(const struct ace_json_reader *reader) {
+  return reader->number;
+}
+
+int64_t ace_json_error_offset(const struct ace_json_reader *reader) {
+  return reader->error_offset;
+}
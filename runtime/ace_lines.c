@@ -0,0 +1,152 @@
+/* Line scanning for lib/sys.ace's LineReader.
+ *
+ * A reader owns one buffer that it refills with read(2) for as long as the
+ * file lasts. Newlines are found with memchr (which libc vectorizes), and a
+ * line is handed back as an offset and length into the buffer, so a line that
+ * arrived in one read is never copied. When a line runs off the end of the
+ * buffer, the unfinished tail is moved to the front before the next read, and
+ * the buffer only grows when a single line is longer than all of it.
+ *
+ * The buffer is one byte longer than its capacity and that byte stays zero,
+ * so the byte after any line is always safe to read.
+ *
+ * A reader made with ace_line_reader_from gets its bytes from a function of
+ * its own in place of read(2); lib/batchio.ace uses that to split files that
+ * were read ahead in batches. */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+void *ace_heap_malloc(uint64_t cb);
+void *ace_heap_malloc_atomic(uint64_t cb);
+int64_t ace_read(int64_t fd, char *pb, int64_t nbyte);
+
+#define LINE_READER_MIN_CAPACITY 4096
+
+/* reads like read(2): returns how many bytes it put in pb, 0 at the end, or
+ * -1 with errno set. */
+typedef int64_t (*ace_line_source_fn)(void *source, char *pb, int64_t cb);
+
+struct ace_line_reader {
+  int64_t fd;
+  /* when fill is set, bytes come from fill(source, ...) instead of fd. */
+  ace_line_source_fn fill;
+  void *source;
+  char *buf;
+  int64_t capacity;
+  /* buf[start, end) has been read but not yet returned. */
+  int64_t start;
+  int64_t end;
+  /* buf[start, start + scanned) is known not to hold a newline. */
+  int64_t scanned;
+  /* where the line most recently returned by ace_line_reader_next begins. */
+  int64_t line;
+  int64_t eof;
+  int64_t err;
+};
+
+struct ace_line_reader *ace_line_reader_new(int64_t fd, int64_t capacity) {
+  if (capacity < LINE_READER_MIN_CAPACITY) {
+    capacity = LINE_READER_MIN_CAPACITY;
+  }
+  /* readers outlive any arena opened while they are read, so neither they
+   * nor their buffers come from one. */
+  struct ace_line_reader *reader = ace_heap_malloc(
+      sizeof(struct ace_line_reader));
+  reader->fd = fd;
+  reader->buf = ace_heap_malloc_atomic(capacity + 1);
+  reader->capacity = capacity;
+  return reader;
+}
+
+struct ace_line_reader *ace_line_reader_from(void *source,
+                                             ace_line_source_fn fill,
+                                             int64_t capacity) {
+  struct ace_line_reader *reader = ace_line_reader_new(-1, capacity);
+  reader->fill = fill;
+  reader->source = source;
+  return reader;
+}
+
+/* forgets what is buffered, and any end or error seen, so that the reader
+ * starts over on whatever its source reads next. the buffer is kept. */
+void ace_line_reader_restart(struct ace_line_reader *reader) {
+  reader->start = 0;
+  reader->end = 0;
+  reader->scanned = 0;
+  reader->line = 0;
+  reader->eof = 0;
+  reader->err = 0;
+}
+
+static void make_room(struct ace_line_reader *reader) {
+  int64_t pending = reader->end - reader->start;
+  if (reader->start != 0) {
+    memmove(reader->buf, reader->buf + reader->start, pending);
+    reader->start = 0;
+    reader->end = pending;
+  }
+  if (pending == reader->capacity) {
+    int64_t capacity = reader->capacity * 2;
+    /* not from an arena: the reader may have been made outside of it. */
+    char *buf = ace_heap_malloc_atomic(capacity + 1);
+    memcpy(buf, reader->buf, pending);
+    reader->buf = buf;
+    reader->capacity = capacity;
+  }
+}
+
+/* returns the length of the next line, including its newline, or -1 once the
+ * file is exhausted. the line itself is at ace_line_reader_line, and stays
+ * there until the next call. */
+int64_t ace_line_reader_next(struct ace_line_reader *reader) {
+  while (1) {
+    char *from = reader->buf + reader->start + reader->scanned;
+    int64_t unscanned = reader->end - reader->start - reader->scanned;
+    char *newline = unscanned > 0 ? memchr(from, '\n', unscanned) : 0;
+    if (newline != 0) {
+      int64_t len = newline + 1 - (reader->buf + reader->start);
+      reader->line = reader->start;
+      reader->start += len;
+      reader->scanned = 0;
+      return len;
+    }
+    reader->scanned += unscanned;
+
+    if (reader->eof) {
+      /* the last line has no newline. */
+      int64_t len = reader->end - reader->start;
+      if (len == 0) {
+        return -1;
+      }
+      reader->line = reader->start;
+      reader->start = reader->end;
+      reader->scanned = 0;
+      return len;
+    }
+
+    make_room(reader);
+    char *into = reader->buf + reader->end;
+    int64_t room = reader->capacity - reader->end;
+    int64_t bytes_read = reader->fill != 0
+                             ? reader->fill(reader->source, into, room)
+                             : ace_read(reader->fd, into, room);
+    if (bytes_read > 0) {
+      reader->end += bytes_read;
+    } else if (bytes_read == 0) {
+      reader->eof = 1;
+    } else if (errno != EINTR) {
+      reader->err = errno;
+      reader->eof = 1;
+    }
+  }
+}
+
+const char *ace_line_reader_line(const struct ace_line_reader *reader) {
+  return reader->buf + reader->line;
+}
+
+/* the errno that stopped the reader early, or 0. */
+int64_t ace_line_reader_errno(const struct ace_line_reader *reader) {
+  return reader->err;
+}
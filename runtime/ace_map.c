@@ -0,0 +1,177 @@
+/* Control bytes for the flat open-addressing hash table in lib/map.ace.
+ *
+ * Every slot of the table has one control byte. It is either EMPTY, DELETED,
+ * or the low 7 bits of the hash of the key stored in that slot. Slots are
+ * probed in aligned groups of GROUP_WIDTH, so one SSE2 compare answers "which
+ * of these 16 slots might hold this key?" for a whole group. The keys, values
+ * and full hashes themselves live in arrays that lib/map.ace owns; this file
+ * only ever reads the hashes. */
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+void *ace_malloc_atomic(uint64_t cb);
+
+struct ace_map_ctrl {
+  int64_t capacity;
+  /* how many more EMPTY slots can be claimed before the table must be
+   * rehashed. keeps the load factor at or under 7/8. */
+  int64_t growth_left;
+  int8_t bytes[];
+};
+
+static inline uint64_t h1(int64_t hash) {
+  return (uint64_t)hash >> 7;
+}
+
+static inline int8_t h2(int64_t hash) {
+  return (int8_t)(hash & 0x7f);
+}
+
+/* bit i is set when group[i] == byte. */
+static inline uint32_t group_match(const int8_t *group, int8_t byte) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; ++i) {
+    if (group[i] == byte) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+/* bit i is set when group[i] is EMPTY or DELETED, which are the only control
+ * bytes with the high bit set. */
+static inline uint32_t group_match_free(const int8_t *group) {
+#ifdef __SSE2__
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_loadu_si128((const __m128i *)group));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; ++i) {
+    if (group[i] < 0) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+/* the first slot of the probe'th group visited for hash. triangular probing
+ * visits every group exactly once because the number of groups is a power of
+ * two. */
+static inline int64_t probe_group(const struct ace_map_ctrl *ctrl,
+                                  int64_t hash,
+                                  int64_t probe) {
+  uint64_t group_mask = (uint64_t)(ctrl->capacity / GROUP_WIDTH) - 1;
+  return (int64_t)(((h1(hash) + (uint64_t)(probe * (probe + 1) / 2)) &
+                    group_mask) *
+                   GROUP_WIDTH);
+}
+
+/* capacity must be a power of two, and at least GROUP_WIDTH. */
+struct ace_map_ctrl *ace_map_ctrl_alloc(int64_t capacity) {
+  struct ace_map_ctrl *ctrl = ace_malloc_atomic(sizeof(struct ace_map_ctrl) +
+                                                capacity);
+  ctrl->capacity = capacity;
+  ctrl->growth_left = capacity - capacity / 8;
+  memset(ctrl->bytes, CTRL_EMPTY, capacity);
+  return ctrl;
+}
+
+int64_t ace_map_capacity(const struct ace_map_ctrl *ctrl) {
+  return ctrl != 0 ? ctrl->capacity : 0;
+}
+
+int64_t ace_map_growth_left(const struct ace_map_ctrl *ctrl) {
+  return ctrl != 0 ? ctrl->growth_left : 0;
+}
+
+/* returns the skip'th slot (counting from 0) along the probe sequence whose
+ * stored hash is exactly hash, or -1. the caller still has to compare keys,
+ * and asks again with skip + 1 on the rare full-hash collision. */
+int64_t ace_map_find(const struct ace_map_ctrl *ctrl,
+                     const int64_t *hashes,
+                     int64_t hash,
+                     int64_t skip) {
+  if (ctrl == 0) {
+    return -1;
+  }
+
+  const int8_t tag = h2(hash);
+  for (int64_t probe = 0; probe < ctrl->capacity / GROUP_WIDTH; ++probe) {
+    int64_t group = probe_group(ctrl, hash, probe);
+    for (uint32_t mask = group_match(ctrl->bytes + group, tag); mask != 0;
+         mask &= mask - 1) {
+      int64_t slot = group + __builtin_ctz(mask);
+      if (hashes[slot] == hash && skip-- == 0) {
+        return slot;
+      }
+    }
+    if (group_match(ctrl->bytes + group, CTRL_EMPTY) != 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+/* marks the first free slot along the probe sequence as holding a key with
+ * this hash and returns it. the caller must make sure that growth_left is
+ * not zero first. */
+int64_t ace_map_claim(struct ace_map_ctrl *ctrl, int64_t hash) {
+  for (int64_t probe = 0;; ++probe) {
+    int64_t group = probe_group(ctrl, hash, probe);
+    uint32_t mask = group_match_free(ctrl->bytes + group);
+    if (mask != 0) {
+      int64_t slot = group + __builtin_ctz(mask);
+      if (ctrl->bytes[slot] == CTRL_EMPTY) {
+        --ctrl->growth_left;
+      }
+      ctrl->bytes[slot] = h2(hash);
+      return slot;
+    }
+  }
+}
+
+/* frees slot, and returns 1 when it went back to EMPTY, or 0 when it had to
+ * be left DELETED. */
+int64_t ace_map_erase(struct ace_map_ctrl *ctrl, int64_t slot) {
+  int64_t group = slot - slot % GROUP_WIDTH;
+  if (group_match(ctrl->bytes + group, CTRL_EMPTY) != 0) {
+    /* every probe that reaches this group stops here anyway, so the slot can
+     * go straight back to being EMPTY. */
+    ctrl->bytes[slot] = CTRL_EMPTY;
+    ++ctrl->growth_left;
+    return 1;
+  }
+  ctrl->bytes[slot] = CTRL_DELETED;
+  return 0;
+}
+
+/* returns the first slot at or after start that holds a key, or -1. */
+int64_t ace_map_next_full(const struct ace_map_ctrl *ctrl, int64_t start) {
+  if (ctrl == 0) {
+    return -1;
+  }
+
+  while (start < ctrl->capacity) {
+    int64_t group = start - start % GROUP_WIDTH;
+    uint32_t mask = ~group_match_free(ctrl->bytes + group) & 0xffff;
+    mask &= ~((1u << (start - group)) - 1);
+    if (mask != 0) {
+      return group + __builtin_ctz(mask);
+    }
+    start = group + GROUP_WIDTH;
+  }
+  return -1;
+}
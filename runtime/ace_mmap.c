@@ -0,0 +1,41 @@
+/* Read-only file mappings for lib/mmap.ace.
+ *
+ * A file of n bytes is mapped into a reservation of n + 1 bytes of anonymous
+ * zeroed memory, so the byte after the last one in the file is always a
+ * readable NUL, even when n is a multiple of the page size. That keeps the
+ * mapping safe to read as a C string. */
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* returns the size of the regular file open at fd, or -1 with errno set. */
+int64_t ace_fd_size(int64_t fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return -1;
+  }
+  return st.st_size;
+}
+
+/* maps the first size bytes of fd, or returns NULL with errno set. */
+const char *ace_mmap_file(int64_t fd, int64_t size) {
+  char *reservation = mmap(0, size + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1, 0);
+  if (reservation == MAP_FAILED) {
+    return 0;
+  }
+  if (size != 0 && mmap(reservation, size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                         fd, 0) == MAP_FAILED) {
+    munmap(reservation, size + 1);
+    return 0;
+  }
+  return reservation;
+}
+
+int64_t ace_munmap_file(const char *pb, int64_t size) {
+  return munmap((void *)pb, size + 1);
+}
+
+int64_t ace_madvise(const char *pb, int64_t size, int64_t advice) {
+  return size != 0 ? madvise((void *)pb, size, advice) : 0;
+}
@@ -4,30 +4,226 @@
 
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
 
+/* the collector has to know about the threads lib/task.ace starts. */
+#define GC_THREADS
 #include <gc/gc.h>
 
 const char **ace_argv;
 int64_t ace_argc;
 
+void ace_flush_all(void);
+static void ace_gc_configure(void);
+static void ace_gc_start(void);
+
 void ace_init(int argc, const char *argv[]) {
 	/* initialize the collector */
+	ace_gc_configure();
 	GC_INIT();
+	ace_gc_start();
 
 	ace_argc = argc;
 	ace_argv = argv;
+
+	/* whatever is still buffered goes out on exit, including via panic. */
+	atexit(ace_flush_all);
 	/* start mutator ... */
 }
 
+/* Collector configuration.
+ *
+ * Each setting comes from its ACE_GC_* environment variable, or else from
+ * the -gc-* flag the program was built with (ace passes those to this file
+ * as macros named after the variables), or else from the collector's own
+ * default. */
+#ifndef ACE_GC_MARKERS
+#define ACE_GC_MARKERS 0
+#endif
+#ifndef ACE_GC_INCREMENTAL
+#define ACE_GC_INCREMENTAL 0
+#endif
+#ifndef ACE_GC_INITIAL_HEAP
+#define ACE_GC_INITIAL_HEAP 0
+#endif
+#ifndef ACE_GC_FREE_SPACE_DIVISOR
+#define ACE_GC_FREE_SPACE_DIVISOR 0
+#endif
+#ifndef ACE_GC_MAX_HEAP
+#define ACE_GC_MAX_HEAP 0
+#endif
+#ifndef ACE_GC_STATS
+#define ACE_GC_STATS 0
+#endif
+
+/* reads a count, or a size like 512k, 64m or 2g. */
+static uint64_t ace_gc_setting(const char *name, uint64_t fallback) {
+  const char *value = getenv(name);
+  if (value == 0 || *value == '\0') {
+    return fallback;
+  }
+  char *end;
+  errno = 0;
+  uint64_t n = strtoull(value, &end, 10);
+  int shift = 0;
+  switch (*end) {
+  case 'k':
+  case 'K':
+    shift = 10;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20;
+    break;
+  case 'g':
+  case 'G':
+    shift = 30;
+    break;
+  }
+  if (shift != 0) {
+    ++end;
+  }
+  if (end == value || *end != '\0' || errno != 0 || n > (UINT64_MAX >> shift)) {
+    fprintf(stderr, "ace: ignoring %s=%s\n", name, value);
+    return fallback;
+  }
+  return n << shift;
+}
+
+static uint64_t ace_gc_markers;
+
+static struct {
+  uint64_t collections_ns;
+  uint64_t collection_started_ns;
+  uint64_t pauses;
+  uint64_t pauses_ns;
+  uint64_t longest_pause_ns;
+  uint64_t pause_started_ns;
+  size_t peak_heap;
+} ace_gc_stats;
+
+static uint64_t ace_monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ace_gc_count_pause(uint64_t pause_ns) {
+  ++ace_gc_stats.pauses;
+  ace_gc_stats.pauses_ns += pause_ns;
+  if (pause_ns > ace_gc_stats.longest_pause_ns) {
+    ace_gc_stats.longest_pause_ns = pause_ns;
+  }
+}
+
+/* the collector calls this with its lock held, so it must not allocate or
+ * call anything that takes the lock. */
+static void ace_gc_on_event(GC_EventType event) {
+  switch (event) {
+  case GC_EVENT_START:
+    ace_gc_stats.collection_started_ns = ace_monotonic_ns();
+    break;
+  case GC_EVENT_END:
+    ace_gc_stats.collections_ns += ace_monotonic_ns() -
+                                   ace_gc_stats.collection_started_ns;
+    if (GC_get_heap_size_inner() > ace_gc_stats.peak_heap) {
+      ace_gc_stats.peak_heap = GC_get_heap_size_inner();
+    }
+    break;
+  case GC_EVENT_PRE_STOP_WORLD:
+    ace_gc_stats.pause_started_ns = ace_monotonic_ns();
+    break;
+  case GC_EVENT_POST_START_WORLD:
+    ace_gc_count_pause(ace_monotonic_ns() - ace_gc_stats.pause_started_ns);
+    break;
+  default:
+    break;
+  }
+}
+
+static void ace_gc_report(void) {
+  const double ms = 1e6;
+  const double mib = 1024.0 * 1024.0;
+  GC_word collections = GC_get_gc_no();
+  if (ace_gc_stats.pauses == 0) {
+    /* collectors built without threads never stop the world as such, and a
+     * whole collection is one pause. */
+    ace_gc_stats.pauses = collections;
+    ace_gc_stats.pauses_ns = ace_gc_stats.collections_ns;
+  }
+  fprintf(stderr,
+          "gc: %lu collections taking %.3f ms, %" PRIu64
+          " pauses taking %.3f ms, the longest %.3f ms\n",
+          (unsigned long)collections, ace_gc_stats.collections_ns / ms,
+          ace_gc_stats.pauses, ace_gc_stats.pauses_ns / ms,
+          ace_gc_stats.longest_pause_ns / ms);
+  size_t heap = GC_get_heap_size();
+  fprintf(stderr,
+          "gc: heap %.1f MiB (peak %.1f MiB, %.1f MiB free), %.1f MiB "
+          "allocated in all\n",
+          heap / mib,
+          (heap > ace_gc_stats.peak_heap ? heap : ace_gc_stats.peak_heap) / mib,
+          GC_get_free_bytes() / mib, GC_get_total_bytes() / mib);
+  fprintf(stderr, "gc: %s marking, %s\n",
+          GC_get_parallel() ? "parallel" : "serial",
+          GC_is_incremental_mode() ? "incremental" : "stop-the-world");
+}
+
+/* settings the collector only takes before GC_INIT. */
+static void ace_gc_configure(void) {
+  ace_gc_markers = ace_gc_setting("ACE_GC_MARKERS", ACE_GC_MARKERS);
+  if (ace_gc_markers != 0) {
+#if GC_VERSION_MAJOR > 8 || (GC_VERSION_MAJOR == 8 && GC_VERSION_MINOR >= 2)
+    GC_set_markers_count((unsigned)ace_gc_markers);
+#else
+    /* older collectors only read this from their environment, in GC_INIT. */
+    char markers[24];
+    snprintf(markers, sizeof(markers), "%" PRIu64, ace_gc_markers);
+    setenv("GC_MARKERS", markers, 1 /*overwrite*/);
+#endif
+  }
+  uint64_t divisor = ace_gc_setting("ACE_GC_FREE_SPACE_DIVISOR",
+                                    ACE_GC_FREE_SPACE_DIVISOR);
+  if (divisor != 0) {
+    /* higher collects more often in a smaller heap, lower the reverse. */
+    GC_set_free_space_divisor(divisor);
+  }
+}
+
+static void ace_gc_start(void) {
+  uint64_t max_heap = ace_gc_setting("ACE_GC_MAX_HEAP", ACE_GC_MAX_HEAP);
+  if (max_heap != 0) {
+    GC_set_max_heap_size(max_heap);
+  }
+  uint64_t initial_heap = ace_gc_setting("ACE_GC_INITIAL_HEAP",
+                                         ACE_GC_INITIAL_HEAP);
+  if (initial_heap > GC_get_heap_size()) {
+    GC_expand_hp(initial_heap - GC_get_heap_size());
+  }
+  if (ace_gc_setting("ACE_GC_INCREMENTAL", ACE_GC_INCREMENTAL) != 0) {
+    /* the collector's incremental mode is also generational: each cycle
+     * only rescans the pages that were written since the last one. */
+    GC_enable_incremental();
+  }
+  if (ace_gc_setting("ACE_GC_STATS", ACE_GC_STATS) != 0) {
+    GC_set_on_collection_event(ace_gc_on_event);
+    atexit(ace_gc_report);
+  }
+}
+
 int64_t ace_sys_argc() {
 	return (int64_t)ace_argc;
 }
@@ -44,36 +240,225 @@ int64_t ace_memcmp(const char *a, const char *b, int64_t len) {
   return memcmp(a, b, len);
 }
 
+/* Buffered output.
+ *
+ * Writes to an fd are gathered in a per-fd buffer and handed to the kernel
+ * when it fills, when the fd is flushed, read from, seeked, or closed, and at
+ * exit. A write that does not fit goes out in one writev along with whatever
+ * was already buffered. Terminals are line buffered. stderr and sockets are
+ * never buffered, since their readers expect each write as soon as it is
+ * made. One lock covers all of the buffers, so that tasks on other threads can
+ * print. */
+#define ACE_OUT_BUFFER_SIZE (64 * 1024)
+#define ACE_OUT_MAX_FDS 1024
+
+enum ace_out_mode {
+  ace_out_unknown = 0,
+  ace_out_unbuffered,
+  ace_out_buffered,
+  ace_out_line_buffered,
+};
+
+struct ace_out {
+  int64_t used;
+  char data[ACE_OUT_BUFFER_SIZE];
+};
+
+static enum ace_out_mode ace_out_modes[ACE_OUT_MAX_FDS];
+static struct ace_out *ace_outs[ACE_OUT_MAX_FDS];
+/* one past the highest fd that has ever had a buffer. */
+static int64_t ace_out_fd_limit = 0;
+static pthread_mutex_t ace_out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static enum ace_out_mode ace_out_mode_for(int64_t fd) {
+  if (fd < 0 || fd >= ACE_OUT_MAX_FDS) {
+    return ace_out_unbuffered;
+  }
+  if (ace_out_modes[fd] == ace_out_unknown) {
+    struct stat st;
+    if (fd == 2 || fstat(fd, &st) == -1 || S_ISSOCK(st.st_mode)) {
+      ace_out_modes[fd] = ace_out_unbuffered;
+    } else if (isatty(fd)) {
+      ace_out_modes[fd] = ace_out_line_buffered;
+    } else {
+      ace_out_modes[fd] = ace_out_buffered;
+    }
+  }
+  return ace_out_modes[fd];
+}
+
+/* writes every byte of iov, retrying short writes. */
+static int64_t ace_writev_all(int64_t fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+/* the callers of these hold ace_out_lock. */
+static int64_t ace_out_flush(int64_t fd) {
+  if (fd < 0 || fd >= ACE_OUT_MAX_FDS || ace_outs[fd] == 0 ||
+      ace_outs[fd]->used == 0) {
+    return 0;
+  }
+  struct ace_out *out = ace_outs[fd];
+  struct iovec iov = {out->data, out->used};
+  /* on failure the buffered bytes are dropped rather than retried forever. */
+  out->used = 0;
+  return ace_writev_all(fd, &iov, 1);
+}
+
+/* flushes fd and forgets what kind of file it was, so that the next fd to get
+ * this number is looked at afresh. */
+static int64_t ace_out_forget(int64_t fd) {
+  int64_t ret = ace_out_flush(fd);
+  if (fd >= 0 && fd < ACE_OUT_MAX_FDS) {
+    free(ace_outs[fd]);
+    ace_outs[fd] = 0;
+    ace_out_modes[fd] = ace_out_unknown;
+  }
+  return ret;
+}
+
+static int64_t ace_out_write(int64_t fd, const char *pb, int64_t nbyte) {
+  enum ace_out_mode mode = ace_out_mode_for(fd);
+  if (mode == ace_out_unbuffered) {
+    return write(fd, pb, nbyte);
+  }
+
+  struct ace_out *out = ace_outs[fd];
+  if (out == 0) {
+    out = ace_outs[fd] = malloc(sizeof(struct ace_out));
+    if (out == 0) {
+      return write(fd, pb, nbyte);
+    }
+    out->used = 0;
+    if (fd >= ace_out_fd_limit) {
+      ace_out_fd_limit = fd + 1;
+    }
+  }
+
+  if (out->used + nbyte > ACE_OUT_BUFFER_SIZE) {
+    /* coalesce what is buffered and this write into one syscall. */
+    struct iovec iov[2] = {{out->data, out->used}, {(char *)pb, nbyte}};
+    out->used = 0;
+    return ace_writev_all(fd, iov, 2) == -1 ? -1 : nbyte;
+  }
+
+  memcpy(out->data + out->used, pb, nbyte);
+  out->used += nbyte;
+  if (mode == ace_out_line_buffered && memchr(pb, '\n', nbyte) != 0) {
+    if (ace_out_flush(fd) == -1) {
+      return -1;
+    }
+  }
+  return nbyte;
+}
+
+int64_t ace_flush(int64_t fd) {
+  pthread_mutex_lock(&ace_out_lock);
+  int64_t ret = ace_out_flush(fd);
+  pthread_mutex_unlock(&ace_out_lock);
+  return ret;
+}
+
+void ace_flush_all(void) {
+  pthread_mutex_lock(&ace_out_lock);
+  for (int64_t fd = 0; fd < ace_out_fd_limit; ++fd) {
+    ace_out_flush(fd);
+  }
+  pthread_mutex_unlock(&ace_out_lock);
+}
+
+int64_t ace_write(int64_t fd, const char *pb, int64_t nbyte) {
+  pthread_mutex_lock(&ace_out_lock);
+  int64_t ret = ace_out_write(fd, pb, nbyte);
+  pthread_mutex_unlock(&ace_out_lock);
+  return ret;
+}
+
+/* writes pb and a newline, with no other thread's output in between. */
+int64_t ace_write_line(int64_t fd, const char *pb, int64_t nbyte) {
+  pthread_mutex_lock(&ace_out_lock);
+  int64_t ret = ace_out_write(fd, pb, nbyte);
+  if (ret != -1 && ace_out_write(fd, "\n", 1) == -1) {
+    ret = -1;
+  }
+  pthread_mutex_unlock(&ace_out_lock);
+  return ret;
+}
+
+/* for every call that hands out a new fd. */
+int64_t ace_out_reset(int64_t fd) {
+  pthread_mutex_lock(&ace_out_lock);
+  int64_t ret = ace_out_forget(fd);
+  pthread_mutex_unlock(&ace_out_lock);
+  return ret;
+}
+
 int64_t ace_open(const char *path, int64_t flags, int64_t mode) {
-  return open(path, flags, mode);
+  int64_t fd = open(path, flags, mode);
+  ace_out_reset(fd);
+  return fd;
 }
 
 int64_t ace_seek(int fd, int64_t offset, int64_t whence) {
+  if (ace_flush(fd) == -1) {
+    return -1;
+  }
   return lseek(fd, offset, whence);
 }
 
 int64_t ace_creat(const char *path, int64_t mode) {
-    return creat(path, mode);
+  int64_t fd = creat(path, mode);
+  ace_out_reset(fd);
+  return fd;
 }
 
 int64_t ace_close(int64_t fd) {
-  return close(fd);
+  int64_t flushed = ace_out_reset(fd);
+  int64_t closed = close(fd);
+  return flushed == -1 ? -1 : closed;
 }
 
 int64_t ace_read(int64_t fd, char *pb, int64_t nbyte) {
+  /* like stdio, make sure a prompt on a terminal is out before blocking on
+   * input, and that reads see this fd's own writes. */
+  pthread_mutex_lock(&ace_out_lock);
+  for (int64_t i = 0; i < ace_out_fd_limit; ++i) {
+    if (i == fd || ace_out_modes[i] == ace_out_line_buffered) {
+      ace_out_flush(i);
+    }
+  }
+  pthread_mutex_unlock(&ace_out_lock);
   return read(fd, pb, nbyte);
 }
 
-int64_t ace_write(int64_t fd, char *pb, int64_t nbyte) {
-  return write(fd, pb, nbyte);
-}
-
 int64_t ace_unlink(const char *filename) {
   return unlink(filename);
 }
 
 int64_t ace_socket(int64_t domain, int64_t type, int64_t protocol) {
-  return socket(domain, type, protocol);
+  int64_t fd = socket(domain, type, protocol);
+  if (fd != -1) {
+    ace_out_reset(fd);
+  }
+  return fd;
 }
 
 const char *ace_memmem(const char *big,
@@ -124,25 +509,388 @@ const char *ace_strerror(int errnum, char *buf, int64_t bufsize) {
 #endif
 }
 
-void *ace_malloc(uint64_t cb) {
-  void *pb = GC_MALLOC(cb);
-  // printf("allocated %" PRId64 " bytes at 0x%08" PRIx64 "\n", cb,
-  // (uint64_t)pb);
+/* Arenas, for lib/arena.ace.
+ *
+ * While a thread has an arena open, ace_malloc and ace_malloc_atomic bump a
+ * pointer through the arena's chunks instead of asking the collector, and
+ * closing the arena gives all of it back at once. Chunks are uncollectable
+ * collector memory: they are scanned for pointers like any other root, but
+ * only ever freed here. Each thread keeps a few spare chunks, cleared as they
+ * come back, so an arena per line of input stops allocating at all once it
+ * has warmed up. Every allocation is zeroed either way, as GC_MALLOC's are.
+ *
+ * Nothing stops arena memory from being stored somewhere that outlives the
+ * arena. With ACE_ARENA_CHECK=1 chunks are instead carved out of one big
+ * reservation of address space, and are made inaccessible as their arena
+ * closes, so an escaped pointer faults on its next use and ace_arena_on_fault
+ * says why. A closed chunk's range stays in quarantine until
+ * ACE_ARENA_QUARANTINE more have closed after it, and only then is handed out
+ * again, so an escape is caught if it is used before that, and a program can
+ * open as many arenas as it likes so long as what they have open at once fits
+ * in the reservation. */
+#define ACE_ARENA_CHUNK_SIZE (64 * 1024)
+/* anything bigger than this gets a chunk of its own. */
+#define ACE_ARENA_LARGE (ACE_ARENA_CHUNK_SIZE / 4)
+#define ACE_ARENA_SPARES 8
+#define ACE_ARENA_ALIGN 16
+#define ACE_ARENA_CHECK_RESERVE ((uint64_t)1 << 36)
+/* 1 GiB of 64 KiB chunks. */
+#define ACE_ARENA_QUARANTINE 16384
+
+struct ace_arena_chunk {
+  struct ace_arena_chunk *next;
+  /* including this header. */
+  uint64_t size;
+  /* the end of what was handed out, once this is not the chunk being
+   * bumped through. */
+  char *used_end;
+};
+
+#define ACE_ARENA_HEADER                                                       \
+  ((sizeof(struct ace_arena_chunk) + ACE_ARENA_ALIGN - 1) &                    \
+   ~(uint64_t)(ACE_ARENA_ALIGN - 1))
+
+struct ace_arena {
+  /* the arena this one was opened inside of. */
+  struct ace_arena *outer;
+  struct ace_arena_chunk *chunks;
+  struct ace_arena_chunk *current;
+  char *next;
+  char *limit;
+};
+
+static __thread struct ace_arena *ace_arena_current;
+static __thread struct ace_arena_chunk *ace_arena_spares;
+static __thread int ace_arena_spare_count;
+
+static pthread_once_t ace_arena_once = PTHREAD_ONCE_INIT;
+static int ace_arena_checked;
+static char *ace_arena_reserve;
+static uint64_t ace_arena_reserved;
+static struct sigaction ace_arena_prior_segv;
+
+/* ranges of the reservation given back by closed arenas. They sit in the
+ * quarantine ring, oldest first, and move to the reusable list as newer ones
+ * push them out. */
+struct ace_arena_range {
+  char *start;
+  uint64_t size;
+};
+
+static pthread_mutex_t ace_arena_ranges_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ace_arena_range ace_arena_quarantine[ACE_ARENA_QUARANTINE];
+static int ace_arena_quarantine_head;
+static int ace_arena_quarantine_count;
+static struct ace_arena_range *ace_arena_reusable;
+static int ace_arena_reusable_count;
+static int ace_arena_reusable_capacity;
+
+static void ace_arena_on_fault(int sig, siginfo_t *info, void *context) {
+  char *addr = info->si_addr;
+  if (addr >= ace_arena_reserve &&
+      addr < ace_arena_reserve + ACE_ARENA_CHECK_RESERVE) {
+    static const char message[] =
+        "ace: arena memory was used after its arena closed. something "
+        "allocated inside `with arena()` was kept outside of it.\n";
+    (void)!write(2, message, sizeof(message) - 1);
+    /* the faulting access runs again, and this time it is fatal. */
+    signal(SIGSEGV, SIG_DFL);
+    return;
+  }
+  if (ace_arena_prior_segv.sa_flags & SA_SIGINFO) {
+    ace_arena_prior_segv.sa_sigaction(sig, info, context);
+  } else if (ace_arena_prior_segv.sa_handler != SIG_DFL &&
+             ace_arena_prior_segv.sa_handler != SIG_IGN) {
+    ace_arena_prior_segv.sa_handler(sig);
+  } else {
+    signal(SIGSEGV, SIG_DFL);
+  }
+}
+
+static void ace_arena_setup(void) {
+  const char *check = getenv("ACE_ARENA_CHECK");
+  if (check == 0 || check[0] == '\0' || strcmp(check, "0") == 0) {
+    return;
+  }
+  void *reserve = mmap(0, ACE_ARENA_CHECK_RESERVE, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserve == MAP_FAILED) {
+    fprintf(stderr, "ace: ignoring ACE_ARENA_CHECK=%s: %s\n", check,
+            strerror(errno));
+    return;
+  }
+  ace_arena_reserve = reserve;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = ace_arena_on_fault;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &ace_arena_prior_segv);
+  ace_arena_checked = 1;
+}
+
+/* finds room for a chunk of (page rounded) size in the reservation, reusing
+ * a range that has been through quarantine where one is big enough. Its size
+ * may then be more than asked for. */
+static struct ace_arena_range ace_arena_range_new(uint64_t size) {
+  struct ace_arena_range range = {0, 0};
+  pthread_mutex_lock(&ace_arena_ranges_lock);
+  /* chunks are nearly all the same size, so this rarely looks past the end. */
+  for (int i = ace_arena_reusable_count - 1; i >= 0; --i) {
+    if (ace_arena_reusable[i].size >= size) {
+      range = ace_arena_reusable[i];
+      ace_arena_reusable[i] = ace_arena_reusable[--ace_arena_reusable_count];
+      break;
+    }
+  }
+  if (range.start == 0 && ace_arena_reserved + size <= ACE_ARENA_CHECK_RESERVE) {
+    range.start = ace_arena_reserve + ace_arena_reserved;
+    range.size = size;
+    ace_arena_reserved += size;
+  }
+  pthread_mutex_unlock(&ace_arena_ranges_lock);
+  if (range.start == 0) {
+    fprintf(stderr, "ace: ACE_ARENA_CHECK has run out of address space\n");
+    abort();
+  }
+  return range;
+}
+
+static void ace_arena_range_free(struct ace_arena_range range) {
+  pthread_mutex_lock(&ace_arena_ranges_lock);
+  if (ace_arena_quarantine_count == ACE_ARENA_QUARANTINE) {
+    if (ace_arena_reusable_count == ace_arena_reusable_capacity) {
+      int capacity = ace_arena_reusable_capacity == 0
+                         ? ACE_ARENA_QUARANTINE
+                         : ace_arena_reusable_capacity * 2;
+      struct ace_arena_range *reusable = realloc(
+          ace_arena_reusable, capacity * sizeof(struct ace_arena_range));
+      if (reusable == 0) {
+        perror("ace: realloc");
+        abort();
+      }
+      ace_arena_reusable = reusable;
+      ace_arena_reusable_capacity = capacity;
+    }
+    ace_arena_reusable[ace_arena_reusable_count++] =
+        ace_arena_quarantine[ace_arena_quarantine_head];
+    ace_arena_quarantine[ace_arena_quarantine_head] = range;
+    ace_arena_quarantine_head =
+        (ace_arena_quarantine_head + 1) % ACE_ARENA_QUARANTINE;
+  } else {
+    ace_arena_quarantine[(ace_arena_quarantine_head +
+                          ace_arena_quarantine_count++) %
+                         ACE_ARENA_QUARANTINE] = range;
+  }
+  pthread_mutex_unlock(&ace_arena_ranges_lock);
+}
+
+static struct ace_arena_chunk *ace_arena_chunk_new(uint64_t size) {
+  struct ace_arena_chunk *chunk;
+  if (ace_arena_checked) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    struct ace_arena_range range =
+        ace_arena_range_new((size + page - 1) & ~(page - 1));
+    /* ranges are cleared with MADV_DONTNEED as they are given back, so even
+     * a reused one reads as zeros. */
+    chunk = (struct ace_arena_chunk *)range.start;
+    size = range.size;
+    if (mprotect(chunk, size, PROT_READ | PROT_WRITE) == -1) {
+      perror("ace: mprotect");
+      abort();
+    }
+    GC_add_roots(chunk, (char *)chunk + size);
+  } else if (size == ACE_ARENA_CHUNK_SIZE && ace_arena_spares != 0) {
+    chunk = ace_arena_spares;
+    ace_arena_spares = chunk->next;
+    --ace_arena_spare_count;
+  } else {
+    chunk = GC_MALLOC_UNCOLLECTABLE(size);
+    if (chunk == 0) {
+      return 0;
+    }
+  }
+  chunk->size = size;
+  chunk->used_end = (char *)chunk + ACE_ARENA_HEADER;
+  return chunk;
+}
+
+static void ace_arena_chunk_free(struct ace_arena_chunk *chunk) {
+  if (ace_arena_checked) {
+    uint64_t size = chunk->size;
+    GC_remove_roots(chunk, (char *)chunk + size);
+    mprotect(chunk, size, PROT_NONE);
+    madvise(chunk, size, MADV_DONTNEED);
+    struct ace_arena_range range = {(char *)chunk, size};
+    ace_arena_range_free(range);
+  } else if (chunk->size == ACE_ARENA_CHUNK_SIZE &&
+             ace_arena_spare_count < ACE_ARENA_SPARES) {
+    char *start = (char *)chunk + ACE_ARENA_HEADER;
+    memset(start, 0, chunk->used_end - start);
+    chunk->next = ace_arena_spares;
+    ace_arena_spares = chunk;
+    ++ace_arena_spare_count;
+  } else {
+    GC_FREE(chunk);
+  }
+}
+
+static void *ace_arena_alloc_slow(struct ace_arena *arena, uint64_t cb) {
+  if (cb > ACE_ARENA_LARGE) {
+    struct ace_arena_chunk *chunk = ace_arena_chunk_new(ACE_ARENA_HEADER + cb);
+    if (chunk == 0) {
+      return 0;
+    }
+    chunk->used_end += cb;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return (char *)chunk + ACE_ARENA_HEADER;
+  }
+  struct ace_arena_chunk *chunk = ace_arena_chunk_new(ACE_ARENA_CHUNK_SIZE);
+  if (chunk == 0) {
+    return 0;
+  }
+  if (arena->current != 0) {
+    arena->current->used_end = arena->next;
+  }
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->current = chunk;
+  arena->next = (char *)chunk + ACE_ARENA_HEADER + cb;
+  arena->limit = (char *)chunk + chunk->size;
+  return (char *)chunk + ACE_ARENA_HEADER;
+}
+
+static void *ace_arena_alloc(struct ace_arena *arena, uint64_t cb) {
+  /* even 0 bytes get an address of their own, as from GC_MALLOC (and a fresh
+   * arena, with next == limit == 0, would otherwise hand back null). */
+  cb = cb == 0 ? ACE_ARENA_ALIGN
+               : (cb + ACE_ARENA_ALIGN - 1) & ~(uint64_t)(ACE_ARENA_ALIGN - 1);
+  if (cb <= (uint64_t)(arena->limit - arena->next)) {
+    void *pb = arena->next;
+    arena->next += cb;
+    return pb;
+  }
+  return ace_arena_alloc_slow(arena, cb);
+}
+
+struct ace_arena *ace_arena_new(void) {
+  pthread_once(&ace_arena_once, ace_arena_setup);
+  return calloc(1, sizeof(struct ace_arena));
+}
+
+/* makes arena the one this thread allocates from, until it is closed. */
+int64_t ace_arena_open(struct ace_arena *arena) {
+  arena->outer = ace_arena_current;
+  ace_arena_current = arena;
+  return 0;
+}
+
+/* frees everything allocated in arena, and goes back to allocating from
+ * wherever the thread did before. */
+int64_t ace_arena_close(struct ace_arena *arena) {
+  if (ace_arena_current != arena) {
+    fprintf(stderr, "ace: arenas must be closed on the thread that opened "
+                    "them, innermost first\n");
+    abort();
+  }
+  ace_arena_current = arena->outer;
+  if (arena->current != 0) {
+    arena->current->used_end = arena->next;
+  }
+  struct ace_arena_chunk *chunk = arena->chunks;
+  while (chunk != 0) {
+    struct ace_arena_chunk *next = chunk->next;
+    ace_arena_chunk_free(chunk);
+    chunk = next;
+  }
+  free(arena);
+  return 0;
+}
+
+/* stops this thread allocating from its arena, until ace_arena_resume is
+ * given what this returns. */
+struct ace_arena *ace_arena_suspend(void) {
+  struct ace_arena *arena = ace_arena_current;
+  ace_arena_current = 0;
+  return arena;
+}
+
+int64_t ace_arena_resume(struct ace_arena *arena) {
+  ace_arena_current = arena;
+  return 0;
+}
+
+/* for runtime structures that may outlive whatever arena the caller has
+ * open, like readers and event loops. */
+void *ace_heap_malloc(uint64_t cb) {
+  return GC_MALLOC(cb);
+}
+
+/* GC_MALLOC_ATOMIC does not clear what it hands back, so zero it here to keep
+ * the same semantics as ace_heap_malloc. */
+void *ace_heap_malloc_atomic(uint64_t cb) {
+  void *pb = GC_MALLOC_ATOMIC(cb);
+  if (pb != 0) {
+    memset(pb, 0, cb);
+  }
   return pb;
 }
 
+void *ace_malloc(uint64_t cb) {
+  struct ace_arena *arena = ace_arena_current;
+  if (arena != 0) {
+    return ace_arena_alloc(arena, cb);
+  }
+  return ace_heap_malloc(cb);
+}
+
+/* for memory the collector never needs to scan (Int arrays, buffers of Char,
+ * tuples of Floats, ...). */
+void *ace_malloc_atomic(uint64_t cb) {
+  struct ace_arena *arena = ace_arena_current;
+  if (arena != 0) {
+    return ace_arena_alloc(arena, cb);
+  }
+  return ace_heap_malloc_atomic(cb);
+}
+
+static char *ace_strndup(const char *sz, size_t len) {
+  char *copy = ace_malloc_atomic(len + 1);
+  memcpy(copy, sz, len);
+  return copy;
+}
+
 int64_t ace_strlen(const char *sz) {
 	return strlen(sz);
 }
 
+/* returns sz itself when the byte after its first cb is a NUL inside the same
+ * collector allocation, and a terminated copy on the heap otherwise. Memory
+ * the collector did not hand out (ffi results, literals, mappings, arenas) may
+ * end right at sz + cb, so it always gets the copy. */
+const char *ace_to_cstring(const char *sz, int64_t cb) {
+  char *base = sz != 0 ? GC_base((void *)sz) : 0;
+  if (base != 0 && sz + cb < base + GC_size(base) && sz[cb] == '\0') {
+    return sz;
+  }
+  char *copy = GC_MALLOC_ATOMIC(cb + 1);
+  if (cb != 0) {
+    memcpy(copy, sz, cb);
+  }
+  copy[cb] = '\0';
+  return copy;
+}
+
 void *ace_print_int64(int64_t x) {
-  printf("%" PRId64 "\n", x);
+  char sz[32];
+  int len = snprintf(sz, sizeof(sz), "%" PRId64 "\n", x);
+  ace_write(1, sz, len);
   return 0;
 }
 
 int64_t ace_write_char(int64_t fd, char x) {
-  char sz[] = {x};
-  return write(fd, sz, 1);
+  return ace_write(fd, &x, 1);
 }
 
 int64_t ace_char_to_int(char ch) {
@@ -159,11 +907,11 @@ char *ace_itoa(int64_t x) {
     perror("Failed in ace_itoa");
     exit(1);
   }
-  return GC_strndup(sz, strlen(sz));
+  return ace_strndup(sz, strlen(sz));
 }
 
 const char *ace_dup_free(const char *src) {
-  const char *sz = GC_strndup(src, strlen(src));
+  const char *sz = ace_strndup(src, strlen(src));
   free((void *)src);
   return sz;
 }
@@ -176,7 +924,7 @@ char *ace_ftoa(double x) {
     perror("Failed in ace_ftoa");
     exit(1);
   }
-  return GC_strndup(sz, strlen(sz));
+  return ace_strndup(sz, strlen(sz));
 }
 
 double ace_atof(const char *sz, size_t n) {
@@ -198,16 +946,16 @@ int64_t ace_atoi(const char *sz, size_t n) {
 }
 
 void ace_pass_test() {
-  write(1, "PASS\n", 5);
+  ace_write(1, "PASS\n", 5);
 }
 
 int64_t ace_puts(char *sz) {
   if (sz == 0) {
     const char *error = "attempt to puts a null pointer!\n";
-    write(1, error, ace_strlen(error));
+    ace_write(1, error, ace_strlen(error));
   }
-  write(1, sz, ace_strlen(sz));
-  write(1, "\n", 1);
+  ace_write(1, sz, ace_strlen(sz));
+  ace_write(1, "\n", 1);
   return 0;
 }
 
@@ -227,6 +975,7 @@ int64_t ace_epoch_millis() {
   return (int64_t)s * 1000 + ms;
 }
 
-int64_t ace_hash_combine(uint64_t seed, uint64_t value) {
-  return seed ^ (value + 0x9e3779b97f4a7c15LLU + (seed << 12) + (seed >> 4));
+/* for timing things; unrelated to the time of day. */
+int64_t ace_monotonic_nanos() {
+  return (int64_t)ace_monotonic_ns();
 }
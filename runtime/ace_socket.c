@@ -0,0 +1,160 @@
+/* Socket calls for lib/socket.ace.
+ *
+ * Addresses are a host (a name or a numeric address) and a port, resolved
+ * with getaddrinfo for the family the socket was made with. Every function
+ * returns -1 with errno set on failure, like the calls it wraps. */
+#define _GNU_SOURCE /* for accept4 */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int64_t ace_out_reset(int64_t fd);
+
+static int socket_family(int64_t fd) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  /* an unbound socket still reports its family. */
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+    return AF_UNSPEC;
+  }
+  return addr.ss_family;
+}
+
+/* calls f with each address host:port resolves to until one succeeds. */
+static int64_t with_address(int64_t fd,
+                            const char *host,
+                            int64_t port,
+                            int passive,
+                            int (*f)(int, const struct sockaddr *, socklen_t)) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = socket_family(fd);
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+  char service[16];
+  snprintf(service, sizeof(service), "%d", (int)port);
+
+  struct addrinfo *addrs;
+  int err = getaddrinfo(host[0] != '\0' ? host : 0, service, &hints, &addrs);
+  if (err != 0) {
+    errno = err == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+    return -1;
+  }
+  int64_t ret = -1;
+  for (struct addrinfo *addr = addrs; addr != 0; addr = addr->ai_next) {
+    ret = f(fd, addr->ai_addr, addr->ai_addrlen);
+    if (ret == 0 || errno == EINPROGRESS) {
+      /* a non-blocking connect finishes later, at this address. */
+      break;
+    }
+  }
+  int saved_errno = errno;
+  freeaddrinfo(addrs);
+  errno = saved_errno;
+  return ret;
+}
+
+/* an empty host binds to every interface. */
+int64_t ace_socket_bind(int64_t fd, const char *host, int64_t port) {
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  return with_address(fd, host, port, 1 /*passive*/, bind);
+}
+
+/* on a non-blocking socket this fails with EINPROGRESS, and the socket turns
+ * writable once ace_socket_error can say how it went. */
+int64_t ace_socket_connect(int64_t fd, const char *host, int64_t port) {
+  /* the small writes of request/response protocols should not wait on
+   * Nagle's algorithm. */
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return with_address(fd, host, port, 0 /*passive*/, connect);
+}
+
+int64_t ace_socket_listen(int64_t fd, int64_t backlog) {
+  return listen(fd, backlog > 0 ? backlog : SOMAXCONN);
+}
+
+/* accepted sockets are non-blocking, like the listener they come from is
+ * expected to be. */
+int64_t ace_socket_accept(int64_t fd) {
+#ifdef __linux__
+  int64_t conn = accept4(fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int64_t conn = accept(fd, 0, 0);
+  if (conn != -1) {
+    fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+    fcntl(conn, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  if (conn != -1) {
+    int on = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+    setsockopt(conn, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    /* this number may have been a buffered file before. */
+    ace_out_reset(conn);
+  }
+  return conn;
+}
+
+int64_t ace_socket_set_nonblocking(int64_t fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1) {
+    return -1;
+  }
+#ifdef SO_NOSIGPIPE
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* the port a socket is bound to, for one bound to port 0. */
+int64_t ace_socket_port(int64_t fd) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+    return -1;
+  }
+  if (addr.ss_family == AF_INET) {
+    return ntohs(((struct sockaddr_in *)&addr)->sin_port);
+  } else if (addr.ss_family == AF_INET6) {
+    return ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+  }
+  errno = EAFNOSUPPORT;
+  return -1;
+}
+
+/* once a non-blocking connect is writable, whether it worked: 0, or the
+ * errno it failed with. */
+int64_t ace_socket_error(int64_t fd) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+    return errno;
+  }
+  return err;
+}
+
+/* one read or write, however much it moves. a peer that has gone away is an
+ * EPIPE, not a SIGPIPE. */
+int64_t ace_socket_recv(int64_t fd, char *pb, int64_t cb) {
+  return recv(fd, pb, cb, 0);
+}
+
+int64_t ace_socket_send(int64_t fd, const char *pb, int64_t cb) {
+#ifdef MSG_NOSIGNAL
+  return send(fd, pb, cb, MSG_NOSIGNAL);
+#else
+  return send(fd, pb, cb, 0);
+#endif
+}
@@ -0,0 +1,121 @@
+/* Radix sort kernels for lib/sort.ace.
+ *
+ * Int and Float vectors are sorted with an LSD radix sort over 8-bit digits.
+ * Keys are first mapped to unsigned integers that sort in the same order as
+ * the original values, all eight digit histograms are counted in a single pass,
+ * and passes whose digit is the same for every key are skipped (which is most
+ * of them for small Ints). Char vectors only need one counting pass. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (64 / RADIX_BITS)
+
+/* below this many elements the histograms cost more than they save. */
+#define RADIX_MIN_COUNT 64
+
+static void insertion_sort_u64(uint64_t *keys, int64_t count) {
+  for (int64_t i = 1; i < count; ++i) {
+    uint64_t key = keys[i];
+    int64_t j = i;
+    for (; j > 0 && keys[j - 1] > key; --j) {
+      keys[j] = keys[j - 1];
+    }
+    keys[j] = key;
+  }
+}
+
+static void radix_sort_u64(uint64_t *keys, int64_t count) {
+  if (count < RADIX_MIN_COUNT) {
+    insertion_sort_u64(keys, count);
+    return;
+  }
+
+  int64_t counts[RADIX_PASSES][RADIX_BUCKETS] = {{0}};
+  for (int64_t i = 0; i < count; ++i) {
+    uint64_t key = keys[i];
+    for (int pass = 0; pass < RADIX_PASSES; ++pass) {
+      ++counts[pass][(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)];
+    }
+  }
+
+  uint64_t *scratch = malloc(sizeof(uint64_t) * count);
+  uint64_t *src = keys;
+  uint64_t *dst = scratch;
+  for (int pass = 0; pass < RADIX_PASSES; ++pass) {
+    const int shift = pass * RADIX_BITS;
+    int64_t *bucket = counts[pass];
+    if (bucket[(src[0] >> shift) & (RADIX_BUCKETS - 1)] == count) {
+      /* every key has the same digit here, so this pass is the identity. */
+      continue;
+    }
+
+    int64_t offset = 0;
+    for (int digit = 0; digit < RADIX_BUCKETS; ++digit) {
+      int64_t n = bucket[digit];
+      bucket[digit] = offset;
+      offset += n;
+    }
+    for (int64_t i = 0; i < count; ++i) {
+      uint64_t key = src[i];
+      dst[bucket[(key >> shift) & (RADIX_BUCKETS - 1)]++] = key;
+    }
+    uint64_t *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  if (src != keys) {
+    memcpy(keys, src, sizeof(uint64_t) * count);
+  }
+  free(scratch);
+}
+
+void ace_radix_sort_ints(int64_t *values, int64_t count) {
+  /* flipping the sign bit orders two's complement Ints as unsigned. */
+  uint64_t *keys = (uint64_t *)values;
+  for (int64_t i = 0; i < count; ++i) {
+    keys[i] ^= (uint64_t)1 << 63;
+  }
+  radix_sort_u64(keys, count);
+  for (int64_t i = 0; i < count; ++i) {
+    keys[i] ^= (uint64_t)1 << 63;
+  }
+}
+
+/* negative Floats have every bit flipped and positive ones just the sign bit,
+ * so the unsigned order of the keys is the numeric order of the Floats. NaNs
+ * end up at one end or the other, depending on their sign. */
+static inline uint64_t float_key(uint64_t bits) {
+  return (bits >> 63) ? ~bits : bits | ((uint64_t)1 << 63);
+}
+
+static inline uint64_t float_bits(uint64_t key) {
+  return (key >> 63) ? key & ~((uint64_t)1 << 63) : ~key;
+}
+
+void ace_radix_sort_floats(double *values, int64_t count) {
+  uint64_t *keys = (uint64_t *)values;
+  for (int64_t i = 0; i < count; ++i) {
+    keys[i] = float_key(keys[i]);
+  }
+  radix_sort_u64(keys, count);
+  for (int64_t i = 0; i < count; ++i) {
+    keys[i] = float_bits(keys[i]);
+  }
+}
+
+void ace_radix_sort_chars(int8_t *values, int64_t count) {
+  /* Chars compare as signed bytes. */
+  int64_t counts[RADIX_BUCKETS] = {0};
+  for (int64_t i = 0; i < count; ++i) {
+    ++counts[(uint8_t)values[i] ^ 0x80];
+  }
+  int64_t i = 0;
+  for (int digit = 0; digit < RADIX_BUCKETS; ++digit) {
+    memset(values + i, digit ^ 0x80, counts[digit]);
+    i += counts[digit];
+  }
+}
@@ -0,0 +1,459 @@
+/* Tasks for lib/task.ace.
+ *
+ * A pool of worker threads runs tasks out of per-worker work-stealing deques
+ * (Chase and Lev, with the C11 orderings from Le, Pop, Cohen and Zappa
+ * Nardelli). A worker pushes and takes at the bottom of its own deque, so
+ * nested spawns run depth first while their data is still in cache, and an
+ * idle worker steals the oldest task from the top of somebody else's. Threads
+ * that are not workers, like the main thread, hand tasks over through a
+ * shared injection queue.
+ *
+ * Joining never just blocks. Until the awaited task is finished the joining
+ * thread runs whatever else is queued, so a task can spawn and join tasks of
+ * its own without tying up a worker, and the thread that started a
+ * parallel_for does its share of the loop.
+ *
+ * Workers are started with GC_pthread_create, so the collector stops and
+ * scans them along with the main thread. Everything that points at a queued
+ * task (the deques, the injection queue) is allocated from the collector and
+ * reachable from the pool, which is a global, so nothing is freed while it
+ * waits to run. */
+#define GC_THREADS
+#include <gc/gc.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* an Ace closure is a pointer to its function followed by its environment,
+ * and the function takes the closure as its last argument. () is passed and
+ * returned as a pointer. */
+typedef void *(*ace_thunk_fn)(void *unit, void *closure);
+typedef void *(*ace_int_body_fn)(int64_t index, void *closure);
+
+#define TASK_DEQUE_MIN_SIZE 64
+/* how many times an idle thread looks for work before it goes to sleep. */
+#define TASK_SPIN_ROUNDS 64
+#define TASK_MAX_WORKERS 512
+
+struct ace_task {
+  void (*run)(struct ace_task *task);
+  void *closure;
+  /* for parallel_for, the indexes [begin, end) and the grain to split to. */
+  int64_t begin;
+  int64_t end;
+  int64_t grain;
+  atomic_int done;
+  /* the next task in the injection queue. */
+  struct ace_task *next;
+};
+
+struct ace_task_array {
+  int64_t size;
+  _Atomic(struct ace_task *) tasks[];
+};
+
+struct ace_deque {
+  atomic_int_fast64_t top;
+  atomic_int_fast64_t bottom;
+  _Atomic(struct ace_task_array *) array;
+};
+
+struct ace_worker {
+  struct ace_deque deque;
+  uint64_t seed;
+};
+
+struct ace_pool {
+  int64_t worker_count;
+  /* the pool's own threads. whichever thread joins makes up the rest of
+   * worker_count. */
+  struct ace_worker *workers;
+  int64_t thread_count;
+
+  pthread_mutex_t inject_lock;
+  _Atomic(struct ace_task *) inject_head;
+  struct ace_task *inject_tail;
+
+  /* tasks pushed and not yet taken, and threads asleep waiting for one. */
+  atomic_int_fast64_t queued;
+  atomic_int_fast64_t sleepers;
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t wake;
+};
+
+static struct ace_pool pool = {
+    .inject_lock = PTHREAD_MUTEX_INITIALIZER,
+    .sleep_lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static __thread struct ace_worker *current_worker;
+
+static struct ace_task_array *task_array_new(int64_t size) {
+  struct ace_task_array *array = GC_MALLOC(
+      sizeof(struct ace_task_array) + size * sizeof(struct ace_task *));
+  if (array == 0) {
+    abort();
+  }
+  array->size = size;
+  return array;
+}
+
+static struct ace_task_array *task_array_grow(struct ace_task_array *array,
+                                              int64_t top,
+                                              int64_t bottom) {
+  struct ace_task_array *grown = task_array_new(array->size * 2);
+  for (int64_t i = top; i < bottom; ++i) {
+    atomic_store_explicit(
+        &grown->tasks[i & (grown->size - 1)],
+        atomic_load_explicit(&array->tasks[i & (array->size - 1)],
+                             memory_order_relaxed),
+        memory_order_relaxed);
+  }
+  /* thieves still reading the old array keep it alive from their stacks. */
+  return grown;
+}
+
+/* only the deque's owner pushes. */
+static void deque_push(struct ace_deque *deque, struct ace_task *task) {
+  int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  struct ace_task_array *array = atomic_load_explicit(&deque->array,
+                                                      memory_order_relaxed);
+  if (bottom - top > array->size - 1) {
+    array = task_array_grow(array, top, bottom);
+    atomic_store_explicit(&deque->array, array, memory_order_release);
+  }
+  atomic_store_explicit(&array->tasks[bottom & (array->size - 1)], task,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/* only the deque's owner takes, from the same end it pushes to. */
+static struct ace_task *deque_take(struct ace_deque *deque) {
+  int64_t bottom = atomic_load_explicit(&deque->bottom,
+                                        memory_order_relaxed) - 1;
+  struct ace_task_array *array = atomic_load_explicit(&deque->array,
+                                                      memory_order_relaxed);
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  struct ace_task *task = 0;
+  if (top <= bottom) {
+    task = atomic_load_explicit(&array->tasks[bottom & (array->size - 1)],
+                                memory_order_relaxed);
+    if (top == bottom) {
+      /* the last task: race the thieves for it. */
+      if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed)) {
+        task = 0;
+      }
+      atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+/* any thread may steal. returns 0 when the deque is empty or another thread
+ * won the race for its oldest task. */
+static struct ace_task *deque_steal(struct ace_deque *deque) {
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom) {
+    return 0;
+  }
+  struct ace_task_array *array = atomic_load_explicit(&deque->array,
+                                                      memory_order_acquire);
+  struct ace_task *task = atomic_load_explicit(
+      &array->tasks[top & (array->size - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return 0;
+  }
+  return task;
+}
+
+static struct ace_task *inject_pop(void) {
+  /* peek without the lock. a task that is missed here is found on the next
+   * round. */
+  if (atomic_load_explicit(&pool.inject_head, memory_order_relaxed) == 0) {
+    return 0;
+  }
+  pthread_mutex_lock(&pool.inject_lock);
+  struct ace_task *task = atomic_load_explicit(&pool.inject_head,
+                                               memory_order_relaxed);
+  if (task != 0) {
+    atomic_store_explicit(&pool.inject_head, task->next, memory_order_relaxed);
+    if (task->next == 0) {
+      pool.inject_tail = 0;
+    }
+    task->next = 0;
+  }
+  pthread_mutex_unlock(&pool.inject_lock);
+  return task;
+}
+
+static void inject_push(struct ace_task *task) {
+  pthread_mutex_lock(&pool.inject_lock);
+  if (pool.inject_tail != 0) {
+    pool.inject_tail->next = task;
+  } else {
+    atomic_store_explicit(&pool.inject_head, task, memory_order_relaxed);
+  }
+  pool.inject_tail = task;
+  pthread_mutex_unlock(&pool.inject_lock);
+}
+
+static uint64_t next_random(uint64_t *seed) {
+  /* xorshift64 */
+  uint64_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *seed = x;
+}
+
+static struct ace_task *find_work(void) {
+  struct ace_worker *self = current_worker;
+  struct ace_task *task = self != 0 ? deque_take(&self->deque) : 0;
+  if (task == 0) {
+    task = inject_pop();
+  }
+  if (task == 0 && pool.thread_count != 0) {
+    /* start at a random victim so that thieves spread out. */
+    static __thread uint64_t outsider_seed = 0x9e3779b97f4a7c15ull;
+    uint64_t start = next_random(self != 0 ? &self->seed : &outsider_seed);
+    for (int64_t i = 0; i < pool.thread_count && task == 0; ++i) {
+      struct ace_worker *victim = &pool.workers[(start + i) %
+                                                pool.thread_count];
+      if (victim != self) {
+        task = deque_steal(&victim->deque);
+      }
+    }
+  }
+  if (task != 0) {
+    atomic_fetch_sub(&pool.queued, 1);
+  }
+  return task;
+}
+
+static void wake_sleepers(int all) {
+  if (atomic_load(&pool.sleepers) != 0) {
+    pthread_mutex_lock(&pool.sleep_lock);
+    if (all) {
+      pthread_cond_broadcast(&pool.wake);
+    } else {
+      pthread_cond_signal(&pool.wake);
+    }
+    pthread_mutex_unlock(&pool.sleep_lock);
+  }
+}
+
+/* sleeps until something is queued, or until awaited (if any) is done. the
+ * sleeper count is raised before the checks, and submit and run_task raise
+ * what is checked before they look at the sleeper count, so one side always
+ * sees the other. */
+static void sleep_until_work(struct ace_task *awaited) {
+  pthread_mutex_lock(&pool.sleep_lock);
+  atomic_fetch_add(&pool.sleepers, 1);
+  while (atomic_load(&pool.queued) <= 0 &&
+         (awaited == 0 || !atomic_load(&awaited->done))) {
+    pthread_cond_wait(&pool.wake, &pool.sleep_lock);
+  }
+  atomic_fetch_sub(&pool.sleepers, 1);
+  pthread_mutex_unlock(&pool.sleep_lock);
+}
+
+static void submit(struct ace_task *task) {
+  atomic_fetch_add(&pool.queued, 1);
+  if (current_worker != 0) {
+    deque_push(&current_worker->deque, task);
+  } else {
+    inject_push(task);
+  }
+  wake_sleepers(0 /*all*/);
+}
+
+static void run_task(struct ace_task *task) {
+  task->run(task);
+  atomic_store(&task->done, 1);
+  /* joiners sleep on the same condition as idle workers. */
+  wake_sleepers(1 /*all*/);
+}
+
+static void *worker_main(void *arg) {
+  current_worker = arg;
+  int idle = 0;
+  while (1) {
+    struct ace_task *task = find_work();
+    if (task != 0) {
+      run_task(task);
+      idle = 0;
+    } else if (++idle < TASK_SPIN_ROUNDS) {
+      sched_yield();
+    } else {
+      sleep_until_work(0);
+      idle = 0;
+    }
+  }
+  return 0;
+}
+
+static void start_pool(void) {
+  if (pool.worker_count <= 0) {
+    const char *workers = getenv("ACE_WORKERS");
+    pool.worker_count = workers != 0 ? atoll(workers) : 0;
+  }
+  if (pool.worker_count <= 0) {
+    pool.worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (pool.worker_count <= 0) {
+    pool.worker_count = 1;
+  } else if (pool.worker_count > TASK_MAX_WORKERS) {
+    pool.worker_count = TASK_MAX_WORKERS;
+  }
+
+  pool.thread_count = pool.worker_count - 1;
+  pool.workers = GC_MALLOC(pool.thread_count * sizeof(struct ace_worker) + 1);
+  for (int64_t i = 0; i < pool.thread_count; ++i) {
+    struct ace_worker *worker = &pool.workers[i];
+    atomic_init(&worker->deque.array, task_array_new(TASK_DEQUE_MIN_SIZE));
+    worker->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+  }
+  for (int64_t i = 0; i < pool.thread_count; ++i) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = GC_pthread_create(&thread, &attr, worker_main,
+                                &pool.workers[i]);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+      /* the deques of threads that never started just stay empty, and
+       * whoever joins picks up their share of the work. */
+      break;
+    }
+  }
+}
+
+/* sets how many threads share the work, counting the one that joins. it only
+ * has an effect before the first task is spawned. returns the count in use. */
+int64_t ace_task_set_workers(int64_t count) {
+  if (count > 0 && pool.workers == 0) {
+    pool.worker_count = count;
+  }
+  pthread_once(&pool_once, start_pool);
+  return pool.worker_count;
+}
+
+int64_t ace_task_workers(void) {
+  pthread_once(&pool_once, start_pool);
+  return pool.worker_count;
+}
+
+static struct ace_task *task_new(void (*run)(struct ace_task *),
+                                 void *closure) {
+  struct ace_task *task = GC_MALLOC(sizeof(struct ace_task));
+  if (task == 0) {
+    abort();
+  }
+  task->run = run;
+  task->closure = closure;
+  return task;
+}
+
+static void run_thunk(struct ace_task *task) {
+  (*(ace_thunk_fn *)task->closure)(0, task->closure);
+}
+
+/* queues the closure (an Ace fn () ()) to run on some worker. */
+struct ace_task *ace_task_spawn(void *closure) {
+  pthread_once(&pool_once, start_pool);
+  struct ace_task *task = task_new(run_thunk, closure);
+  submit(task);
+  return task;
+}
+
+/* returns once task has run, running other tasks in the meantime. */
+void ace_task_join(struct ace_task *task) {
+  int idle = 0;
+  while (!atomic_load(&task->done)) {
+    struct ace_task *other = find_work();
+    if (other != 0) {
+      run_task(other);
+      idle = 0;
+    } else if (++idle < TASK_SPIN_ROUNDS) {
+      sched_yield();
+    } else {
+      sleep_until_work(task);
+      idle = 0;
+    }
+  }
+}
+
+static void run_range(struct ace_task *task);
+
+/* runs body over [begin, end), first splitting off upper halves as tasks for
+ * other threads to steal until what is left is no bigger than grain. */
+static void for_range(void *closure,
+                      int64_t begin,
+                      int64_t end,
+                      int64_t grain) {
+  struct ace_task *halves[64];
+  int split = 0;
+  while (end - begin > grain && split < 64) {
+    int64_t middle = begin + (end - begin) / 2;
+    struct ace_task *upper = task_new(run_range, closure);
+    upper->begin = middle;
+    upper->end = end;
+    upper->grain = grain;
+    submit(upper);
+    halves[split++] = upper;
+    end = middle;
+  }
+
+  ace_int_body_fn body = *(ace_int_body_fn *)closure;
+  for (int64_t i = begin; i < end; ++i) {
+    body(i, closure);
+  }
+
+  /* the smallest half was pushed last, so it is the first to come back. */
+  while (split > 0) {
+    ace_task_join(halves[--split]);
+  }
+}
+
+static void run_range(struct ace_task *task) {
+  for_range(task->closure, task->begin, task->end, task->grain);
+}
+
+/* calls the closure (an Ace fn (Int) ()) with every index in [begin, end),
+ * spread across the workers. a grain of 0 or less picks one that gives each
+ * worker about eight pieces to balance with. */
+void ace_task_parallel_for(int64_t begin,
+                           int64_t end,
+                           int64_t grain,
+                           void *closure) {
+  pthread_once(&pool_once, start_pool);
+  if (end <= begin) {
+    return;
+  }
+  if (grain <= 0) {
+    grain = (end - begin) / (pool.worker_count * 8);
+  }
+  if (grain < 1) {
+    grain = 1;
+  }
+  for_range(closure, begin, end, grain);
+}
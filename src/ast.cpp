@@ -305,6 +305,28 @@ std::ostream &Conditional::render(std::ostream &os,
   return os << ")";
 }
 
+Location Switch::get_location() const {
+  return scrutinee->get_location();
+}
+
+std::ostream &Switch::render(std::ostream &os, int parent_precedence) const {
+  const int precedence = 11;
+  Parens parens(os, parent_precedence, precedence);
+  os << "(" C_CONTROL "switch " C_RESET;
+  scrutinee->render(os, precedence);
+  for (auto &case_ : cases) {
+    os << " (" << case_.first << " => ";
+    case_.second->render(os, precedence);
+    os << ")";
+  }
+  if (default_case != nullptr) {
+    os << " (_ => ";
+    default_case->render(os, precedence);
+    os << ")";
+  }
+  return os << ")";
+}
+
 std::ostream &PatternBlock::render(std::ostream &os) const {
   os << "(";
   predicate->render(os);
@@ -528,6 +550,15 @@ tarjan::Vertices get_free_vars(
     set_merge(free_vars, get_free_vars(condition->truthy, bound_vars));
     set_merge(free_vars, get_free_vars(condition->falsey, bound_vars));
     return free_vars;
+  } else if (auto switch_ = dcast<const ast::Switch *>(expr)) {
+    tarjan::Vertices free_vars = get_free_vars(switch_->scrutinee, bound_vars);
+    for (auto &case_ : switch_->cases) {
+      set_merge(free_vars, get_free_vars(case_.second, bound_vars));
+    }
+    if (switch_->default_case != nullptr) {
+      set_merge(free_vars, get_free_vars(switch_->default_case, bound_vars));
+    }
+    return free_vars;
   } else if (dcast<const ast::Break *>(expr)) {
     return {};
   } else if (dcast<const ast::Continue *>(expr)) {
@@ -228,6 +228,22 @@ struct CtorPredicate : public Predicate {
                         bool &returns,
                         TranslateContinuationFn &matched,
                         TranslateContinuationFn &failed) const override;
+  /* destructures the params of a scrutinee that is already known to have
+   * been built by this ctor. */
+  const Expr *translate_params(
+      const types::DefnId &defn_id,
+      const Identifier &scrutinee_id,
+      const types::Ref &scrutinee_type,
+      bool do_checks,
+      const DataCtorsMap &data_ctors_map,
+      const std::unordered_set<std::string> &bound_vars,
+      const TrackedTypes &tracked_types,
+      const types::TypeEnv &type_env,
+      TrackedTypes &typing,
+      types::NeededDefns &needed_defns,
+      bool &returns,
+      TranslateContinuationFn &matched,
+      TranslateContinuationFn &failed) const;
   const Predicate *rewrite(
       const RewriteImportRules &rewrite_import_rules) const override;
   Location get_location() const override;
@@ -410,6 +426,23 @@ struct Conditional : public Expr {
   const Expr *falsey;
 };
 
+/* only produced by translate_match_expr. jumps straight to the case whose
+ * value equals the Int (or Char) scrutinee, or to default_case when there is
+ * none. a null default_case means that the cases are exhaustive. */
+struct Switch : public Expr {
+  typedef std::vector<std::pair<int64_t, const Expr *>> Cases;
+
+  Switch(const Expr *scrutinee, Cases cases, const Expr *default_case)
+      : scrutinee(scrutinee), cases(cases), default_case(default_case) {
+  }
+  Location get_location() const override;
+  std::ostream &render(std::ostream &os, int parent_precedence) const override;
+
+  const Expr *scrutinee;
+  Cases cases;
+  const Expr *default_case;
+};
+
 struct ReturnStatement : public Expr {
   ReturnStatement(const Expr *value) : value(value) {
   }
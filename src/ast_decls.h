@@ -19,6 +19,7 @@ struct Lambda;
 struct Let;
 struct Literal;
 struct Conditional;
+struct Switch;
 struct ReturnStatement;
 struct While;
 struct Decl;
@@ -104,6 +104,8 @@ const types::Scheme::Map &get_builtins() {
                                          type_arrows({tv_a, Int, tv_b}));
     (*map)["__builtin_cmp_ctor_id"] = scheme(INTERNAL_LOC(), {"a"}, {},
                                              type_arrows({tv_a, Int, Bool}));
+    (*map)["__builtin_get_ctor_id"] = scheme(INTERNAL_LOC(), {"a"}, {},
+                                             type_arrows({tv_a, Int}));
     (*map)["__builtin_int_to_char"] = scheme(INTERNAL_LOC(), {}, {},
                                              type_arrows({Int, Char}));
     (*map)["__builtin_int_eq"] = scheme(INTERNAL_LOC(), {}, {},
@@ -156,10 +158,19 @@ const types::Scheme::Map &get_builtins() {
     (*map)["__builtin_memcmp"] = scheme(
         INTERNAL_LOC(), {}, {}, type_arrows({PtrToChar, PtrToChar, Int, Int}));
     (*map)["__builtin_pass_test"] = scheme(INTERNAL_LOC(), {}, {}, Unit);
+    (*map)["__builtin_unreachable"] = scheme(INTERNAL_LOC(), {"a"}, {}, tv_a);
     (*map)["__builtin_print_int"] = scheme(
         INTERNAL_LOC(), {}, {}, type_arrows({Int, type_unit(INTERNAL_LOC())}));
     (*map)["__builtin_calloc"] = scheme(INTERNAL_LOC(), {"a"}, {},
                                         type_arrows({Int, tp_a}));
+    (*map)["__builtin_alloc_items"] = scheme(INTERNAL_LOC(), {"a"}, {},
+                                             type_arrows({Int, tp_a}));
+    (*map)["__builtin_copy_items"] = scheme(
+        INTERNAL_LOC(), {"a"}, {},
+        type_arrows({tp_a, tp_a, Int, type_unit(INTERNAL_LOC())}));
+    (*map)["__builtin_clear_items"] = scheme(
+        INTERNAL_LOC(), {"a"}, {},
+        type_arrows({tp_a, Int, type_unit(INTERNAL_LOC())}));
     (*map)["__builtin_store_ref"] =
         scheme(INTERNAL_LOC(), {"a"}, {},
                type_arrows(
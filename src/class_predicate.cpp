@@ -15,7 +15,11 @@
 namespace types {
 
 size_t ClassPredicateRefHasher::operator()(const ClassPredicateRef &rhs) const {
-  return std::hash<std::string>()(rhs->repr());
+  size_t hash = std::hash<std::string>()(rhs->classname.name);
+  for (auto &param : rhs->params) {
+    hash = hash_combine(hash, param->hash());
+  }
+  return hash;
 }
 
 bool ClassPredicateRefEqualTo::operator()(const ClassPredicateRef &lhs,
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <iostream>
 #include <set>
+#include <sstream>
 #include <sys/stat.h>
 #include <vector>
 
@@ -12,6 +13,7 @@
 #include "import_rules.h"
 #include "lexer.h"
 #include "link_ins.h"
+#include "module_cache.h"
 #include "parse_state.h"
 #include "parser.h"
 #include "prefix.h"
@@ -165,6 +167,7 @@ struct GlobalParserState {
   parser::SymbolImports symbol_imports;
   std::vector<Token> comments;
   std::set<LinkIn> link_ins;
+  std::map<std::string, uint64_t> module_keys;
   const std::map<std::string, int> &builtin_arities;
 
   const Module *parse_module_statefully(
@@ -186,31 +189,49 @@ struct GlobalParserState {
     ifs.open(module_filename.c_str());
 
     if (ifs.good()) {
-      debug_above(11, log(log_info, "parsing module " c_id("%s"),
-                          module_filename.c_str()));
-      Lexer lexer({module_filename}, ifs);
-
-      parser::ParseState ps(module_filename, "", lexer, comments, link_ins,
-                            symbol_exports, symbol_imports, builtin_arities);
-
-      std::set<Identifier> dependencies;
-      const Module *module = parse_module(ps, {modules_map_by_name["std"]},
-                                          dependencies);
+      std::stringstream ss;
+      ss << ifs.rdbuf();
+      std::string source = ss.str();
+
+      /* everything but the prelude is parsed against the prelude's exports, so
+       * its key is folded into theirs */
+      uint64_t key = module_cache::get_key(
+          module_filename, source,
+          get(module_keys, std::string("std"), uint64_t(0)));
+
+      module_cache::ModuleArtifacts artifacts;
+      if (module_cache::enabled() && module_cache::load(key, artifacts)) {
+        debug_above(2, log(log_info, "loaded module " c_id("%s") " from cache",
+                           module_filename.c_str()));
+        symbol_exports[artifacts.module->name] = artifacts.symbol_exports;
+        symbol_imports[artifacts.module->name] = artifacts.symbol_imports;
+        link_ins.insert(artifacts.link_ins.begin(), artifacts.link_ins.end());
+        comments.insert(comments.end(), artifacts.comments.begin(),
+                        artifacts.comments.end());
+      } else {
+        artifacts.module = parse_module_source(module_filename, source,
+                                               artifacts);
+        if (module_cache::enabled()) {
+          module_cache::store(key, artifacts);
+        }
+      }
 
+      const Module *module = artifacts.module;
       modules.push_back(module);
+      module_keys[module->name] = key;
 
       /* break any circular dependencies. inject this module into the graph */
-      modules_map_by_name[ps.module_name] = module;
-      modules_map_by_filename[ps.filename] = module;
+      modules_map_by_name[module->name] = module;
+      modules_map_by_filename[module_filename] = module;
 
       debug_above(8, log("while parsing %s got module dependencies {%s}",
-                         ps.module_name.c_str(),
-                         join(dependencies, ", ").c_str()));
+                         module->name.c_str(),
+                         join(artifacts.dependencies, ", ").c_str()));
 
       const maybe<std::string> reference_path = directory_from_file_path(
           module_filename);
 
-      for (auto dependency : dependencies) {
+      for (auto dependency : artifacts.dependencies) {
         parse_module_statefully(dependency, reference_path);
       }
 
@@ -224,6 +245,34 @@ struct GlobalParserState {
       throw error;
     }
   }
+
+  /* lex and parse a module, capturing everything it adds to the global state
+   * so that it can be cached. */
+  const Module *parse_module_source(const std::string &module_filename,
+                                    const std::string &source,
+                                    module_cache::ModuleArtifacts &artifacts) {
+    debug_above(11, log(log_info, "parsing module " c_id("%s"),
+                        module_filename.c_str()));
+    std::istringstream iss(source);
+    Lexer lexer({module_filename}, iss);
+
+    const size_t comments_start = comments.size();
+    std::set<LinkIn> module_link_ins;
+    parser::ParseState ps(module_filename, "", lexer, comments,
+                          module_link_ins, symbol_exports, symbol_imports,
+                          builtin_arities);
+
+    const Module *module = parse_module(ps, {modules_map_by_name["std"]},
+                                        artifacts.dependencies);
+
+    artifacts.symbol_exports = symbol_exports[ps.module_name];
+    artifacts.symbol_imports = symbol_imports[ps.module_name];
+    artifacts.link_ins = module_link_ins;
+    artifacts.comments.assign(comments.begin() + comments_start,
+                              comments.end());
+    link_ins.insert(module_link_ins.begin(), module_link_ins.end());
+    return module;
+  }
 };
 
 std::set<std::string> get_top_level_decls(
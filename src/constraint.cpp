@@ -11,11 +11,6 @@ Constraint::Constraint(types::Ref a, types::Ref b, Context &&context)
     : a(a), b(b), context(std::move(context)) {
 }
 
-void Constraint::rebind(const types::Map &env) {
-  a = a->rebind(env);
-  b = b->rebind(env);
-}
-
 std::string Constraint::str() const {
   return string_format("%s == %s because %s", a->str().c_str(),
                        b->str().c_str(), context.message.c_str());
@@ -36,19 +31,6 @@ void append_to_constraints(Constraints &constraints,
   constraints.push_back({a, b, std::move(context)});
 }
 
-void rebind_constraints(Constraints::iterator iter,
-                        const Constraints::iterator &end,
-                        const Map &bindings) {
-  if (bindings.size() == 0) {
-    /* nothing to rebind, bail */
-    return;
-  }
-
-  while (iter != end) {
-    (*iter++).rebind(bindings);
-  }
-}
-
 } // namespace types
 
 std::string str(const types::Constraints &constraints) {
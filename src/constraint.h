@@ -15,8 +15,6 @@ struct Constraint {
   Ref a, b;
   Context context;
 
-  void rebind(const Map &env);
-
   std::string str() const;
 };
 
@@ -26,9 +24,6 @@ void append_to_constraints(Constraints &constraints,
                            Ref a,
                            Ref b,
                            Context &&context);
-void rebind_constraints(Constraints::iterator iter,
-                        const Constraints::iterator &end,
-                        const Map &bindings);
 } // namespace types
 
 std::string str(const types::Constraints &constraints);
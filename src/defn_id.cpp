@@ -24,7 +24,10 @@ std::string DefnId::repr() const {
 }
 
 bool DefnId::operator<(const DefnId &rhs) const {
-  return repr() < rhs.repr();
+  if (id.name != rhs.id.name) {
+    return id.name < rhs.id.name;
+  }
+  return compare(type.get(), rhs.type.get()) < 0;
 }
 
 std::ostream &operator<<(std::ostream &os, const DefnId &defn_id) {
@@ -0,0 +1,136 @@
+#include "escape_analysis.h"
+
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <set>
+
+#include "dbg.h"
+#include "llvm_utils.h"
+#include "logger.h"
+
+/* anything bigger than this stays on the heap so that deep recursion does not
+ * blow the stack */
+#define MAX_DEMOTED_ALLOCATION_SIZE 256
+
+namespace ace {
+
+namespace {
+
+/* a pointer escapes if it (or anything derived from it) could be observed
+ * after the function returns. stores *into* the allocation, loads from it and
+ * comparisons are fine. anything else, including merging it through a phi
+ * (which could carry it across loop iterations), counts as an escape. */
+bool pointer_escapes(llvm::Value *llvm_pointer,
+                     std::set<llvm::Value *> &visited) {
+  if (!visited.insert(llvm_pointer).second) {
+    return false;
+  }
+
+  for (llvm::Use &use : llvm_pointer->uses()) {
+    llvm::User *user = use.getUser();
+    if (llvm::isa<llvm::LoadInst>(user) || llvm::isa<llvm::ICmpInst>(user)) {
+      continue;
+    } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+      if (store->getValueOperand() == llvm_pointer) {
+        return true;
+      }
+    } else if (llvm::isa<llvm::BitCastInst>(user) ||
+               llvm::isa<llvm::GetElementPtrInst>(user)) {
+      if (pointer_escapes(user, visited)) {
+        return true;
+      }
+    } else if (llvm::isa<llvm::MemIntrinsic>(user)) {
+      continue;
+    } else if (auto call = llvm::dyn_cast<llvm::CallBase>(user)) {
+      if (!call->isArgOperand(&use) ||
+          !call->doesNotCapture(call->getArgOperandNo(&use))) {
+        return true;
+      }
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string get_allocated_type_name(llvm::CallInst *llvm_call) {
+  for (auto user : llvm_call->users()) {
+    if (auto bitcast = llvm::dyn_cast<llvm::BitCastInst>(user)) {
+      std::string type_name;
+      llvm::raw_string_ostream os(type_name);
+      bitcast->getDestTy()->getPointerElementType()->print(os);
+      return os.str();
+    }
+  }
+  return "i8";
+}
+
+} // namespace
+
+void llvm_demote_nonescaping_allocations(
+    llvm::Module &llvm_module,
+    std::vector<DemotedAllocation> &demoted_allocations) {
+  const llvm::DataLayout &data_layout = llvm_module.getDataLayout();
+  std::vector<llvm::CallInst *> llvm_calls;
+  for (auto alloc_function_name : {"ace_malloc", "ace_malloc_atomic"}) {
+    llvm::Function *llvm_malloc = llvm_module.getFunction(alloc_function_name);
+    if (llvm_malloc == nullptr) {
+      continue;
+    }
+    for (auto user : llvm_malloc->users()) {
+      if (auto llvm_call = llvm::dyn_cast<llvm::CallInst>(user)) {
+        if (llvm_call->getCalledFunction() == llvm_malloc) {
+          llvm_calls.push_back(llvm_call);
+        }
+      }
+    }
+  }
+
+  for (auto llvm_call : llvm_calls) {
+    /* the sizes come from llvm_sizeof_type, which needs the data layout to
+     * fold into an integer */
+    auto llvm_size =
+        llvm::dyn_cast<llvm::Constant>(llvm_call->getArgOperand(0));
+    if (llvm_size == nullptr) {
+      continue;
+    }
+    auto llvm_size_int = llvm::dyn_cast_or_null<llvm::ConstantInt>(
+        llvm::ConstantFoldConstant(llvm_size, data_layout));
+    if (llvm_size_int == nullptr ||
+        llvm_size_int->getZExtValue() > MAX_DEMOTED_ALLOCATION_SIZE) {
+      continue;
+    }
+
+    std::set<llvm::Value *> visited;
+    if (pointer_escapes(llvm_call, visited)) {
+      continue;
+    }
+
+    uint64_t size = llvm_size_int->getZExtValue();
+    llvm::Function *llvm_function = llvm_call->getFunction();
+    demoted_allocations.push_back({llvm_function->getName().str(),
+                                   get_allocated_type_name(llvm_call), size});
+    debug_above(3, log("demoting %s", llvm_print(llvm_call).c_str()));
+
+    llvm::BasicBlock &entry_block = llvm_function->getEntryBlock();
+    llvm::IRBuilder<> entry_builder(&entry_block,
+                                    entry_block.getFirstInsertionPt());
+    llvm::AllocaInst *llvm_slot = entry_builder.CreateAlloca(
+        llvm::ArrayType::get(entry_builder.getInt8Ty(), size), nullptr,
+        "demoted");
+    llvm_slot->setAlignment(llvm::Align(16));
+
+    /* GC_MALLOC hands back zeroed memory, so the stack slot must be zeroed
+     * on every pass through the allocation site. DSE removes this when the
+     * tuple is fully initialized right away. */
+    llvm::IRBuilder<> builder(llvm_call);
+    llvm::Value *llvm_slot_pointer = builder.CreateBitCast(
+        llvm_slot, llvm_call->getType());
+    builder.CreateMemSet(llvm_slot_pointer, builder.getInt8(0), size,
+                         llvm::MaybeAlign(16));
+    llvm_call->replaceAllUsesWith(llvm_slot_pointer);
+    llvm_call->eraseFromParent();
+  }
+}
+
+} // namespace ace
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "llvm_ace.h"
+
+namespace ace {
+
+struct DemotedAllocation {
+  std::string function_name;
+  std::string type_name;
+  uint64_t size;
+};
+
+/* finds calls to ace_malloc or ace_malloc_atomic with a small constant size
+ * whose result never leaves the calling function, and replaces them with
+ * zeroed stack slots in the entry block. the module must already have its
+ * data layout. */
+void llvm_demote_nonescaping_allocations(
+    llvm::Module &llvm_module,
+    std::vector<DemotedAllocation> &demoted_allocations);
+
+} // namespace ace
@@ -194,6 +194,14 @@ void get_free_vars(const ast::Expr *expr,
     get_free_vars(condition->cond, typing, globals, locals, free_vars);
     get_free_vars(condition->truthy, typing, globals, locals, free_vars);
     get_free_vars(condition->falsey, typing, globals, locals, free_vars);
+  } else if (auto switch_ = dcast<const ast::Switch *>(expr)) {
+    get_free_vars(switch_->scrutinee, typing, globals, locals, free_vars);
+    for (auto &case_ : switch_->cases) {
+      get_free_vars(case_.second, typing, globals, locals, free_vars);
+    }
+    if (switch_->default_case != nullptr) {
+      get_free_vars(switch_->default_case, typing, globals, locals, free_vars);
+    }
   } else if (dcast<const ast::Break *>(expr)) {
   } else if (dcast<const ast::Continue *>(expr)) {
   } else if (auto while_ = dcast<const ast::While *>(expr)) {
@@ -356,20 +364,29 @@ llvm::Value *gen_ffi_call(llvm::IRBuilder<> &builder,
                      }).c_str()));
 
   auto llvm_module = llvm_get_module(builder);
+  /* C only ever sees tuples by reference, the way they are laid out on the
+   * heap */
+  std::vector<llvm::Value *> ffi_params;
   std::vector<llvm::Type *> terms;
   for (size_t i = 0; i < params.size(); ++i) {
-    terms.push_back(params[i]->getType());
+    ffi_params.push_back(llvm_convert_value(
+        builder, llvm_module, params[i],
+        llvm_storage_type(builder, params[i]->getType())));
+    terms.push_back(ffi_params.back()->getType());
   }
 
+  llvm::Type *llvm_return_type = get_llvm_type(builder, type_env, type_ffi);
   auto llvm_func_decl = llvm::cast<llvm::Function>(
       llvm_module
-          ->getOrInsertFunction(id.name.c_str(),
-                                llvm::FunctionType::get(
-                                    get_llvm_type(builder, type_env, type_ffi),
-                                    llvm::ArrayRef<llvm::Type *>(terms),
-                                    false /*isVarArg*/))
+          ->getOrInsertFunction(
+              id.name.c_str(),
+              llvm::FunctionType::get(
+                  llvm_storage_type(builder, llvm_return_type),
+                  llvm::ArrayRef<llvm::Type *>(terms), false /*isVarArg*/))
           .getCallee());
-  return builder.CreateCall(llvm_func_decl, params);
+  return llvm_convert_value(builder, llvm_module,
+                            builder.CreateCall(llvm_func_decl, ffi_params),
+                            llvm_return_type);
 }
 
 llvm::Value *gen_builtin(llvm::IRBuilder<> &builder,
@@ -478,9 +495,12 @@ llvm::Value *gen_builtin(llvm::IRBuilder<> &builder,
         builder.getInt64Ty());
   } else if (name == "__builtin_ptr_load") {
     /* scheme({"a"}, {}, type_arrows({tp_a, tv_a})) */
-    return builder.CreateLoad(
-        params[0],
-        string_format("__builtin_ptr_load.{%s}", id.location.repr().c_str()));
+    return llvm_convert_value(
+        builder, llvm_get_module(builder),
+        builder.CreateLoad(params[0],
+                           string_format("__builtin_ptr_load.{%s}",
+                                         id.location.repr().c_str())),
+        get_llvm_type(builder, type_env, type_builtin));
   } else if (name == "__builtin_get_dim") {
     /* scheme({"a", "b"}, {}, type_arrows({tv_a, Int, tv_b})) */
   } else if (name == "__builtin_cmp_ctor_id") {
@@ -512,6 +532,12 @@ llvm::Value *gen_builtin(llvm::IRBuilder<> &builder,
               params[1]),
           builder.getInt64Ty());
     }
+  } else if (name == "__builtin_get_ctor_id") {
+    /* scheme({"a"}, {}, type_arrows({tv_a, Int})) */
+    return builder.CreateLoad(
+        builder.CreateBitOrPointerCast(params[0],
+                                       builder.getInt64Ty()->getPointerTo()),
+        string_format("ctor_id_load.{%s}", id.location.repr().c_str()));
   } else if (name == "__builtin_int_to_char") {
     /* scheme({}, {}, type_arrows({Int, Char})) */
     return builder.CreateSExtOrTrunc(params[0], builder.getInt8Ty());
@@ -615,6 +641,25 @@ llvm::Value *gen_builtin(llvm::IRBuilder<> &builder,
                                         false /*isVarArg*/))
             .getCallee());
     return builder.CreateCall(llvm_func_decl, params);
+  } else if (name == "__builtin_unreachable") {
+    /* scheme({"a"}, {}, tv_a) */
+    auto llvm_module = llvm_get_module(builder);
+
+    assert(params.size() == 0);
+
+    /* control never gets here, but the value still has to have a type, so
+     * abort and hand back an undef of whatever type the caller wants. */
+    auto llvm_func_decl = llvm::cast<llvm::Function>(
+        llvm_module
+            ->getOrInsertFunction(
+                "abort", llvm::FunctionType::get(builder.getVoidTy(),
+                                                 llvm::ArrayRef<llvm::Type *>(),
+                                                 false /*isVarArg*/))
+            .getCallee());
+    llvm_func_decl->setDoesNotReturn();
+    builder.CreateCall(llvm_func_decl);
+    return llvm::UndefValue::get(
+        get_llvm_type(builder, type_env, type_builtin));
   } else if (name == "__builtin_print_int") {
     /* scheme({}, {}, type_arrows({*Char, type_unit(INTERNAL_LOC())})) */
     auto llvm_module = llvm_get_module(builder);
@@ -652,21 +697,74 @@ llvm::Value *gen_builtin(llvm::IRBuilder<> &builder,
   } else if (name == "__builtin_calloc") {
     /* scheme({"a"}, {}, type_arrows({Int, tp_a})) */
     auto llvm_module = llvm_get_module(builder);
-    llvm::Type *param_types[] = {builder.getInt64Ty()};
 
     assert(params.size() == 1);
 
+    /* arrays of Int, Float, Char, etc... are never scanned by the GC */
+    llvm::Type *llvm_array_type = get_llvm_type(builder, type_env,
+                                                type_builtin);
+    auto ffi_function = llvm_get_alloc_function(
+        builder, llvm_module, llvm_array_type->getPointerElementType());
+    return llvm_maybe_pointer_cast(
+        builder, builder.CreateCall(ffi_function, params), llvm_array_type);
+  } else if (name == "__builtin_alloc_items") {
+    /* scheme({"a"}, {}, type_arrows({Int, tp_a})) */
+    auto llvm_module = llvm_get_module(builder);
+
+    assert(params.size() == 1);
+
+    /* sizeof is still the word size, but small tuples are stored inline, so
+     * the element size has to come from the element type itself */
+    llvm::Type *llvm_array_type = get_llvm_type(builder, type_env,
+                                                type_builtin);
+    llvm::Type *llvm_element_type = llvm_array_type->getPointerElementType();
+    auto ffi_function = llvm_get_alloc_function(builder, llvm_module,
+                                                llvm_element_type);
+    return llvm_maybe_pointer_cast(
+        builder,
+        builder.CreateCall(
+            ffi_function,
+            {builder.CreateMul(params[0],
+                               llvm_sizeof_type(builder, llvm_element_type))}),
+        llvm_array_type);
+  } else if (name == "__builtin_copy_items") {
+    /* scheme({"a"}, {}, type_arrows({tp_a, tp_a, Int,
+     * type_unit(INTERNAL_LOC())})) */
+    auto llvm_module = llvm_get_module(builder);
+    llvm::Type *param_types[] = {builder.getInt8Ty()->getPointerTo(),
+                                 builder.getInt8Ty()->getPointerTo(),
+                                 builder.getInt64Ty()};
+
+    assert(params.size() == 3);
+
     auto ffi_function = llvm::cast<llvm::Function>(
         llvm_module
-            ->getOrInsertFunction("ace_malloc",
+            ->getOrInsertFunction("memcpy",
                                   llvm::FunctionType::get(
                                       builder.getInt8Ty()->getPointerTo(),
                                       llvm::ArrayRef<llvm::Type *>(param_types),
                                       false /*isVarArg*/))
             .getCallee());
-    return llvm_maybe_pointer_cast(
-        builder, builder.CreateCall(ffi_function, params),
-        get_llvm_type(builder, type_env, type_builtin));
+    llvm::Type *llvm_element_type =
+        params[0]->getType()->getPointerElementType();
+    builder.CreateCall(
+        ffi_function,
+        {llvm_maybe_pointer_cast(builder, params[0], param_types[0]),
+         llvm_maybe_pointer_cast(builder, params[1], param_types[1]),
+         builder.CreateMul(params[2],
+                           llvm_sizeof_type(builder, llvm_element_type))});
+    return llvm::Constant::getNullValue(builder.getInt8Ty()->getPointerTo());
+  } else if (name == "__builtin_clear_items") {
+    /* scheme({"a"}, {}, type_arrows({tp_a, Int, type_unit(INTERNAL_LOC())})) */
+    assert(params.size() == 2);
+    llvm::Type *llvm_element_type =
+        params[0]->getType()->getPointerElementType();
+    builder.CreateMemSet(
+        params[0], builder.getInt8(0),
+        builder.CreateMul(params[1],
+                          llvm_sizeof_type(builder, llvm_element_type)),
+        llvm::MaybeAlign());
+    return llvm::Constant::getNullValue(builder.getInt8Ty()->getPointerTo());
   } else if (name == "__builtin_store_ref") {
     /* scheme({"a"}, {}, type_arrows({
      * type_operator(type_id(make_iid(REF_TYPE_OPERATOR)), tv_a), tv_a,
@@ -1232,6 +1330,88 @@ ResolutionStatus gen(std::string name,
         builder.CreateBr(merge_block);
       }
 
+      if (merge_block != nullptr) {
+        builder.SetInsertPoint(merge_block);
+        if (phi_node != nullptr) {
+          publish(phi_node);
+        } else {
+          assert(type_equality(type, type_unit(INTERNAL_LOC())));
+        }
+      }
+      return rs_cache_resolution;
+    } else if (auto switch_ = dcast<const ast::Switch *>(expr)) {
+      llvm::Value *llvm_scrutinee = gen(
+          builder, llvm_module, defer_guard, break_to_block, continue_to_block,
+          switch_->scrutinee, typing, type_env, gen_env_globals, gen_env_locals,
+          globals);
+      llvm::IntegerType *llvm_scrutinee_type = llvm::cast<llvm::IntegerType>(
+          llvm_scrutinee->getType());
+
+      llvm::Function *llvm_function = llvm_get_function(builder);
+
+      auto tag = ast::fresh();
+      llvm::BasicBlock *default_block = llvm::BasicBlock::Create(
+          builder.getContext(),
+          string_format("switch_default.%s{%s}", tag.c_str(),
+                        switch_->get_location().repr().c_str()),
+          llvm_function);
+      llvm::SwitchInst *llvm_switch = builder.CreateSwitch(
+          llvm_scrutinee, default_block, switch_->cases.size());
+
+      llvm::BasicBlock *merge_block = nullptr;
+      llvm::PHINode *phi_node = nullptr;
+      auto gen_case = [&](const ast::Expr *body) {
+        llvm::Value *value = gen(builder, llvm_module, defer_guard,
+                                 break_to_block, continue_to_block, body,
+                                 typing, type_env, gen_env_globals,
+                                 gen_env_locals, globals);
+        if (builder.GetInsertBlock()->getTerminator()) {
+          return;
+        }
+        if (merge_block == nullptr) {
+          merge_block = llvm::BasicBlock::Create(
+              builder.getContext(),
+              string_format("merge%s{%s}", tag.c_str(),
+                            switch_->get_location().repr().c_str()),
+              llvm_function);
+        }
+        if (!types::is_unit(type) && value != nullptr) {
+          if (phi_node == nullptr) {
+            phi_node = llvm::PHINode::Create(
+                value->getType(), switch_->cases.size() + 1,
+                string_format("phi%s{%s}", tag.c_str(),
+                              switch_->get_location().repr().c_str()),
+                merge_block);
+#ifdef ACE_DEBUG
+            phi_node->setName(string_format("phi::%s", type->repr().c_str()));
+#endif
+          }
+          phi_node->addIncoming(value, builder.GetInsertBlock());
+        }
+        builder.CreateBr(merge_block);
+      };
+
+      for (auto &case_ : switch_->cases) {
+        llvm::BasicBlock *case_block = llvm::BasicBlock::Create(
+            builder.getContext(),
+            string_format("case.%lld.%s", (long long)case_.first, tag.c_str()),
+            llvm_function);
+        llvm_switch->addCase(
+            llvm::ConstantInt::get(llvm_scrutinee_type, case_.first,
+                                   true /*isSigned*/),
+            case_block);
+        builder.SetInsertPoint(case_block);
+        gen_case(case_.second);
+      }
+
+      builder.SetInsertPoint(default_block);
+      if (switch_->default_case != nullptr) {
+        gen_case(switch_->default_case);
+      } else {
+        /* the coverage check proved that one of the cases matches */
+        builder.CreateUnreachable();
+      }
+
       if (merge_block != nullptr) {
         builder.SetInsertPoint(merge_block);
         if (phi_node != nullptr) {
@@ -1339,7 +1519,7 @@ ResolutionStatus gen(std::string name,
                                  type_env, gen_env_globals, gen_env_locals,
                                  globals));
       }
-      publish(llvm_tuple_alloc(builder, llvm_module, dim_values));
+      publish(llvm_tuple_create(builder, llvm_module, dim_values));
       return rs_cache_resolution;
     } else if (auto tuple_deref = dcast<const ast::TupleDeref *>(expr)) {
       auto td = gen(builder, llvm_module, defer_guard, break_to_block,
@@ -1349,6 +1529,13 @@ ResolutionStatus gen(std::string name,
                                    "created tuple deref %s from %s",
                                    llvm_print(td).c_str(),
                                    tuple_deref->expr->str().c_str()));
+      if (llvm_is_unboxed_type(td->getType())) {
+        publish(builder.CreateExtractValue(
+            td, {(unsigned)tuple_deref->index},
+            string_format("tuple_deref.{%s}",
+                          tuple_deref->get_location().repr().c_str())));
+        return rs_cache_resolution;
+      }
       llvm::Value *gep_path[] = {builder.getInt32(0),
                                  builder.getInt32(tuple_deref->index)};
       llvm::Value *load = builder.CreateLoad(
@@ -1368,12 +1555,10 @@ ResolutionStatus gen(std::string name,
                   log("casting %s (which is %s) to type %s (which is %s)",
                       as->expr->str().c_str(), llvm_print(expr_value).c_str(),
                       as->type->str().c_str(), llvm_print(cast_type).c_str()));
-      if (cast_type == expr_value->getType()) {
-        /* slight cleanup to avoid extraneous bitcast */
-        publish(expr_value);
-      } else {
-        publish(builder.CreateBitOrPointerCast(expr_value, cast_type));
-      }
+      /* casting between a data type and the tuple that holds its ctor's
+       * fields boxes or unboxes small tuples */
+      publish(
+          llvm_convert_value(builder, llvm_module, expr_value, cast_type));
       return rs_cache_resolution;
     } else if (dcast<const ast::Sizeof *>(expr)) {
       assert(false);
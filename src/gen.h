@@ -13,9 +13,11 @@ namespace ace {
 namespace gen {
 
 struct DeferGuard;
-typedef std::unordered_map<
-    std::string,
-    std::map<types::Ref, std::shared_ptr<Resolver>, types::CompareType>>
+typedef std::unordered_map<std::string,
+                           std::unordered_map<types::Ref,
+                                              std::shared_ptr<Resolver>,
+                                              types::HashType,
+                                              types::EqualType>>
     GenEnv;
 
 typedef std::unordered_map<std::string, llvm::Value *> GenLocalEnv;
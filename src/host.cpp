@@ -2,6 +2,7 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -227,6 +228,11 @@ void init_host() {
 #endif
   V(SOCK_STREAM);
   V(SOCK_DGRAM);
+  V(MADV_NORMAL);
+  V(MADV_SEQUENTIAL);
+  V(MADV_RANDOM);
+  V(MADV_WILLNEED);
+  V(MADV_DONTNEED);
 }
 
 int get_host_int(Location location, std::string name) {
@@ -0,0 +1,121 @@
+#include "jit.h"
+
+#include "dbg.h"
+#include "logger.h"
+#include "user_error.h"
+
+namespace ace {
+
+namespace {
+
+typedef int (*gc_add_roots_t)(void *, void *);
+typedef int (*main_t)(int, const char **);
+
+/* the collector only scans the data segments of objects the dynamic loader
+ * knows about. globals in JIT'd code live in memory we allocate ourselves, so
+ * register their writable sections as roots once they are finalized. */
+struct GCRootsMemoryManager : public llvm::SectionMemoryManager {
+  uint8_t *allocateDataSection(uintptr_t size,
+                               unsigned alignment,
+                               unsigned section_id,
+                               llvm::StringRef section_name,
+                               bool is_read_only) override {
+    uint8_t *section = llvm::SectionMemoryManager::allocateDataSection(
+        size, alignment, section_id, section_name, is_read_only);
+    if (!is_read_only && section != nullptr && size != 0) {
+      data_sections.push_back({section, size});
+    }
+    return section;
+  }
+
+  bool finalizeMemory(std::string *error_message) override {
+    if (llvm::SectionMemoryManager::finalizeMemory(error_message)) {
+      return true;
+    }
+
+    auto gc_add_roots = reinterpret_cast<gc_add_roots_t>(
+        llvm::sys::DynamicLibrary::SearchForAddressOfSymbol("GC_add_roots"));
+    /* the collector may not be linked in at all, without the prelude */
+    if (gc_add_roots != nullptr) {
+      for (auto &data_section : data_sections) {
+        gc_add_roots(data_section.first,
+                     data_section.first + data_section.second);
+      }
+    }
+    data_sections.clear();
+    return false;
+  }
+
+  std::vector<std::pair<uint8_t *, uintptr_t>> data_sections;
+};
+
+void check(llvm::Error error) {
+  if (error) {
+    throw user_error(INTERNAL_LOC(), "jit: %s",
+                     llvm::toString(std::move(error)).c_str());
+  }
+}
+
+template <typename T> T check(llvm::Expected<T> expected) {
+  if (!expected) {
+    check(expected.takeError());
+  }
+  return std::move(*expected);
+}
+
+} // namespace
+
+int jit_run_module(std::unique_ptr<llvm::LLVMContext> llvm_context,
+                   std::unique_ptr<llvm::Module> llvm_module,
+                   const std::vector<std::string> &shared_objects,
+                   std::string program_name,
+                   const std::vector<std::string> &args) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  /* make the runtime and its dependencies visible to the process-wide symbol
+   * search before anything gets linked */
+  for (auto &shared_object : shared_objects) {
+    std::string error;
+    if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(
+            shared_object.c_str(), &error)) {
+      throw user_error(INTERNAL_LOC(), "unable to load %s: %s",
+                       shared_object.c_str(), error.c_str());
+    }
+  }
+
+  auto jit = check(
+      llvm::orc::LLJITBuilder()
+          .setObjectLinkingLayerCreator(
+              [](llvm::orc::ExecutionSession &execution_session,
+                 const llvm::Triple &) {
+                return std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+                    execution_session,
+                    []() { return std::make_unique<GCRootsMemoryManager>(); });
+              })
+          .create());
+
+  llvm::orc::JITDylib &main_dylib = jit->getMainJITDylib();
+  main_dylib.addGenerator(
+      check(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          jit->getDataLayout().getGlobalPrefix())));
+
+  llvm_module->setDataLayout(jit->getDataLayout());
+  check(jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(llvm_module),
+                                                     std::move(llvm_context))));
+
+  auto main_symbol = check(jit->lookup("main"));
+  auto main_function = reinterpret_cast<main_t>(main_symbol.getAddress());
+
+  std::vector<const char *> argv;
+  argv.push_back(program_name.c_str());
+  for (auto &arg : args) {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(nullptr);
+
+  debug_above(1, log("jit: calling main in %s", program_name.c_str()));
+  return main_function(argv.size() - 1, argv.data());
+}
+
+} // namespace ace
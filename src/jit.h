@@ -0,0 +1,19 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm_ace.h"
+
+namespace ace {
+
+/* loads the shared objects into the process, hands the module to an ORC
+ * LLJIT and calls its main with argv set to program_name followed by args.
+ * returns whatever main returns. */
+int jit_run_module(std::unique_ptr<llvm::LLVMContext> llvm_context,
+                   std::unique_ptr<llvm::Module> llvm_module,
+                   const std::vector<std::string> &shared_objects,
+                   std::string program_name,
+                   const std::vector<std::string> &args);
+
+} // namespace ace
@@ -24,7 +24,10 @@ LinkIn::LinkIn(LinkInType lit, Token name) : lit(lit), name(name) {
 }
 
 bool LinkIn::operator<(const LinkIn &rhs) const {
-  return lit < rhs.lit || name < rhs.name;
+  if (lit != rhs.lit) {
+    return lit < rhs.lit;
+  }
+  return name < rhs.name;
 }
 
 } // namespace ace
@@ -372,6 +372,149 @@ void llvm_verify_module(llvm::Module &llvm_module) {
   // std::cerr << ss.str() << std::endl;
 }
 
+std::unique_ptr<llvm::TargetMachine> llvm_create_host_target_machine(
+    OptLevel opt_level) {
+  static bool initialized = false;
+  if (!initialized) {
+    initialized = true;
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+  }
+
+  std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string error;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple,
+                                                                  error);
+  if (target == nullptr) {
+    throw user_error(INTERNAL_LOC(), "unable to find target for %s: %s",
+                     triple.c_str(), error.c_str());
+  }
+
+  llvm::CodeGenOpt::Level codegen_level = llvm::CodeGenOpt::None;
+  switch (opt_level) {
+  case ol_O0:
+    codegen_level = llvm::CodeGenOpt::None;
+    break;
+  case ol_O1:
+    codegen_level = llvm::CodeGenOpt::Less;
+    break;
+  case ol_O2:
+    codegen_level = llvm::CodeGenOpt::Default;
+    break;
+  case ol_O3:
+    codegen_level = llvm::CodeGenOpt::Aggressive;
+    break;
+  }
+
+  /* target the same generic cpu that clang would so that binaries stay
+   * portable across machines of the same architecture */
+  llvm::TargetOptions options;
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, "generic", "" /*features*/, options, llvm::Reloc::PIC_,
+      llvm::None /*code_model*/, codegen_level));
+}
+
+void llvm_optimize_module(llvm::Module &llvm_module,
+                          llvm::TargetMachine &target_machine,
+                          OptLevel opt_level,
+                          std::vector<DemotedAllocation> &demoted_allocations) {
+  llvm_module.setTargetTriple(target_machine.getTargetTriple().str());
+  llvm_module.setDataLayout(target_machine.createDataLayout());
+
+  /* demoting first lets SROA promote most of the stack slots to registers */
+  llvm_demote_nonescaping_allocations(llvm_module, demoted_allocations);
+
+  llvm::PassBuilder::OptimizationLevel level =
+      llvm::PassBuilder::OptimizationLevel::O0;
+  switch (opt_level) {
+  case ol_O0:
+    /* the default pipelines don't accept O0. there is nothing more to do. */
+    return;
+  case ol_O1:
+    level = llvm::PassBuilder::OptimizationLevel::O1;
+    break;
+  case ol_O2:
+    level = llvm::PassBuilder::OptimizationLevel::O2;
+    break;
+  case ol_O3:
+    level = llvm::PassBuilder::OptimizationLevel::O3;
+    break;
+  }
+
+  llvm::PassBuilder pass_builder(&target_machine);
+  llvm::LoopAnalysisManager loop_analysis_manager;
+  llvm::FunctionAnalysisManager function_analysis_manager;
+  llvm::CGSCCAnalysisManager cgscc_analysis_manager;
+  llvm::ModuleAnalysisManager module_analysis_manager;
+  pass_builder.registerModuleAnalyses(module_analysis_manager);
+  pass_builder.registerCGSCCAnalyses(cgscc_analysis_manager);
+  pass_builder.registerFunctionAnalyses(function_analysis_manager);
+  pass_builder.registerLoopAnalyses(loop_analysis_manager);
+  pass_builder.crossRegisterProxies(
+      loop_analysis_manager, function_analysis_manager, cgscc_analysis_manager,
+      module_analysis_manager);
+
+  llvm::ModulePassManager module_pass_manager =
+      pass_builder.buildPerModuleDefaultPipeline(level);
+  module_pass_manager.run(llvm_module, module_analysis_manager);
+
+  /* inlining exposes more allocations that stay local, mostly closure
+   * environments whose call sites were resolved. clean up after them. */
+  size_t demoted_count = demoted_allocations.size();
+  llvm_demote_nonescaping_allocations(llvm_module, demoted_allocations);
+  if (demoted_allocations.size() != demoted_count) {
+    llvm::FunctionPassManager function_pass_manager;
+    function_pass_manager.addPass(llvm::SROA());
+    function_pass_manager.addPass(llvm::InstCombinePass());
+    function_pass_manager.addPass(llvm::DSEPass());
+    llvm::ModulePassManager cleanup_pass_manager;
+    cleanup_pass_manager.addPass(llvm::createModuleToFunctionPassAdaptor(
+        std::move(function_pass_manager)));
+    cleanup_pass_manager.run(llvm_module, module_analysis_manager);
+  }
+}
+
+void llvm_write_ll_file(llvm::Module &llvm_module, std::string filename) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(filename, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    throw user_error(INTERNAL_LOC(), "unable to open %s: %s",
+                     filename.c_str(), ec.message().c_str());
+  }
+  llvm_module.print(os, nullptr /*AssemblyAnnotationWriter*/);
+}
+
+void llvm_write_bitcode_file(llvm::Module &llvm_module, std::string filename) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(filename, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    throw user_error(INTERNAL_LOC(), "unable to open %s: %s",
+                     filename.c_str(), ec.message().c_str());
+  }
+  llvm::WriteBitcodeToFile(llvm_module, os);
+}
+
+void llvm_write_object_file(llvm::Module &llvm_module,
+                            llvm::TargetMachine &target_machine,
+                            std::string filename) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(filename, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    throw user_error(INTERNAL_LOC(), "unable to open %s: %s",
+                     filename.c_str(), ec.message().c_str());
+  }
+
+  /* code generation still runs on the legacy pass manager */
+  llvm::legacy::PassManager pass_manager;
+  if (target_machine.addPassesToEmitFile(pass_manager, os, nullptr,
+                                         llvm::CGFT_ObjectFile)) {
+    throw user_error(INTERNAL_LOC(), "%s cannot emit object files",
+                     target_machine.getTargetTriple().str().c_str());
+  }
+  pass_manager.run(llvm_module);
+  os.flush();
+}
+
 llvm::Constant *llvm_sizeof_type(llvm::IRBuilder<> &builder,
                                  llvm::Type *llvm_type) {
   llvm::StructType *llvm_struct_type = llvm::dyn_cast<llvm::StructType>(
@@ -531,6 +674,17 @@ llvm::Type *get_llvm_closure_type(llvm::IRBuilder<> &builder,
       ->getPointerTo();
 }
 
+static int llvm_count_words(llvm::Type *llvm_type) {
+  if (auto llvm_struct_type = llvm::dyn_cast<llvm::StructType>(llvm_type)) {
+    int words = 0;
+    for (auto element : llvm_struct_type->elements()) {
+      words += llvm_count_words(element);
+    }
+    return words;
+  }
+  return 1;
+}
+
 llvm::Type *get_llvm_type_(llvm::IRBuilder<> &builder,
                            const types::TypeEnv &type_env,
                            const types::Ref &type_) {
@@ -563,10 +717,14 @@ llvm::Type *get_llvm_type_(llvm::IRBuilder<> &builder,
         builder, type_env, tuple_type->dimensions);
     llvm::StructType *llvm_struct_type = llvm_create_struct_type(builder,
                                                                  llvm_types);
+    if (llvm_count_words(llvm_struct_type) <= MAX_UNBOXED_TUPLE_WORDS) {
+      return llvm_struct_type;
+    }
     return llvm_struct_type->getPointerTo();
   } else if (auto operator_ = dyncast<const types::TypeOperator>(type)) {
     if (types::is_type_id(operator_->oper, PTR_TYPE_OPERATOR)) {
-      /* handle pointer types */
+      /* handle pointer types. small tuples are stored inline, so a *String
+       * steps through its elements two words at a time. */
       return get_llvm_type(builder, type_env, operator_->operand)
           ->getPointerTo();
     } else {
@@ -631,7 +789,8 @@ llvm::FunctionType *llvm_main_function_type(llvm::IRBuilder<> &builder) {
 }
 
 llvm::Constant *llvm_get_zero_value(llvm::Type *llvm_type) {
-  if (llvm_type->isPointerTy()) {
+  if (llvm_type->isPointerTy() || llvm_type->isStructTy() ||
+      llvm_type->isFloatingPointTy()) {
     return llvm::Constant::getNullValue(llvm_type);
   } else {
     if (!llvm_type->isIntegerTy()) {
@@ -643,6 +802,146 @@ llvm::Constant *llvm_get_zero_value(llvm::Type *llvm_type) {
   }
 }
 
+bool llvm_type_contains_pointers(llvm::Type *llvm_type) {
+  if (auto llvm_struct_type = llvm::dyn_cast<llvm::StructType>(llvm_type)) {
+    for (auto element : llvm_struct_type->elements()) {
+      if (llvm_type_contains_pointers(element)) {
+        return true;
+      }
+    }
+    return false;
+  } else if (auto llvm_array_type = llvm::dyn_cast<llvm::ArrayType>(
+                 llvm_type)) {
+    return llvm_type_contains_pointers(llvm_array_type->getElementType());
+  } else {
+    return llvm_type->isPointerTy();
+  }
+}
+
+llvm::Function *llvm_get_alloc_function(llvm::IRBuilder<> &builder,
+                                        llvm::Module *llvm_module,
+                                        llvm::Type *llvm_element_type) {
+  llvm::Type *alloc_terms[] = {builder.getInt64Ty()};
+  return llvm::cast<llvm::Function>(
+      llvm_module
+          ->getOrInsertFunction(
+              llvm_type_contains_pointers(llvm_element_type)
+                  ? "ace_malloc"
+                  : "ace_malloc_atomic",
+              llvm::FunctionType::get(builder.getInt8Ty()->getPointerTo(),
+                                      alloc_terms, false /*isVarArg*/))
+          .getCallee());
+}
+
+static llvm::Value *llvm_alloc_managed(llvm::IRBuilder<> &builder,
+                                       llvm::Module *llvm_module,
+                                       llvm::Type *llvm_type) {
+  return builder.CreateBitCast(
+      builder.CreateCall(
+          llvm_get_alloc_function(builder, llvm_module, llvm_type),
+          std::vector<llvm::Value *>{llvm_sizeof_type(builder, llvm_type)}),
+      llvm_type->getPointerTo());
+}
+
+bool llvm_is_unboxed_type(llvm::Type *llvm_type) {
+  return llvm_type->isStructTy();
+}
+
+llvm::Type *llvm_storage_type(llvm::IRBuilder<> &builder,
+                              llvm::Type *llvm_type) {
+  if (llvm_is_unboxed_type(llvm_type)) {
+    return builder.getInt8Ty()->getPointerTo();
+  }
+  return llvm_type;
+}
+
+llvm::Value *llvm_tuple_create(llvm::IRBuilder<> &builder,
+                               llvm::Module *llvm_module,
+                               const std::vector<llvm::Value *> llvm_dims) {
+  if (llvm_dims.size() == 0) {
+    return llvm::Constant::getNullValue(builder.getInt8Ty()->getPointerTo());
+  }
+
+  llvm::StructType *llvm_tuple_type = llvm_create_struct_type(builder,
+                                                              llvm_dims);
+  if (llvm_count_words(llvm_tuple_type) > MAX_UNBOXED_TUPLE_WORDS) {
+    return llvm_tuple_alloc(builder, llvm_module, llvm_dims);
+  }
+
+  /* the builder folds these into a constant struct when the dims are all
+   * constants */
+  llvm::Value *llvm_tuple = llvm::UndefValue::get(llvm_tuple_type);
+  for (size_t i = 0; i < llvm_dims.size(); ++i) {
+    llvm_tuple = builder.CreateInsertValue(llvm_tuple, llvm_dims[i],
+                                           {(unsigned)i});
+  }
+  return llvm_tuple;
+}
+
+llvm::Value *llvm_box_value(llvm::IRBuilder<> &builder,
+                            llvm::Module *llvm_module,
+                            llvm::Value *llvm_value) {
+  llvm::Type *llvm_type = llvm_value->getType();
+  if (builder.GetInsertBlock() == nullptr) {
+    /* we are at global scope, so let's not allocate */
+    return llvm::ConstantExpr::getBitCast(
+        llvm_get_global(llvm_module, "tuple",
+                        llvm::cast<llvm::Constant>(llvm_value),
+                        true /*is_constant*/),
+        builder.getInt8Ty()->getPointerTo());
+  }
+
+  llvm::Value *llvm_box = llvm_alloc_managed(builder, llvm_module, llvm_type);
+  builder.CreateStore(llvm_value, llvm_box);
+  return builder.CreateBitCast(llvm_box, builder.getInt8Ty()->getPointerTo());
+}
+
+llvm::Value *llvm_convert_value(llvm::IRBuilder<> &builder,
+                                llvm::Module *llvm_module,
+                                llvm::Value *llvm_value,
+                                llvm::Type *llvm_type) {
+  llvm::Type *llvm_value_type = llvm_value->getType();
+  if (llvm_value_type == llvm_type) {
+    return llvm_value;
+  }
+
+  bool from_unboxed = llvm_is_unboxed_type(llvm_value_type);
+  bool to_unboxed = llvm_is_unboxed_type(llvm_type);
+  if (!from_unboxed && !to_unboxed) {
+    return builder.CreateBitOrPointerCast(llvm_value, llvm_type);
+  } else if (from_unboxed && llvm_type->isPointerTy()) {
+    /* the value is headed somewhere that expects a managed pointer, like a
+     * data ctor or an ffi call */
+    return builder.CreateBitCast(
+        llvm_box_value(builder, llvm_module, llvm_value), llvm_type);
+  } else if (to_unboxed && llvm_value_type->isPointerTy()) {
+    return builder.CreateLoad(
+        llvm_type,
+        builder.CreateBitCast(llvm_value, llvm_type->getPointerTo()));
+  } else {
+    /* reinterpret the bits through a stack slot. SROA cleans this up. The
+     * slot has to hold whichever type is bigger, and when that is the target,
+     * the bytes the value doesn't cover read as zeros. ssa_gen gives the
+     * module its data layout before generating any code. */
+    const llvm::DataLayout &data_layout = llvm_module->getDataLayout();
+    bool widening = data_layout.getTypeAllocSize(llvm_type) >
+                    data_layout.getTypeAllocSize(llvm_value_type);
+    llvm::Function *llvm_function = llvm_get_function(builder);
+    llvm::IRBuilder<> entry_builder(&llvm_function->getEntryBlock(),
+                                    llvm_function->getEntryBlock().begin());
+    llvm::AllocaInst *llvm_slot = entry_builder.CreateAlloca(
+        widening ? llvm_type : llvm_value_type);
+    if (widening) {
+      builder.CreateStore(llvm::Constant::getNullValue(llvm_type), llvm_slot);
+    }
+    builder.CreateStore(
+        llvm_value,
+        builder.CreateBitCast(llvm_slot, llvm_value_type->getPointerTo()));
+    return builder.CreateLoad(
+        llvm_type, builder.CreateBitCast(llvm_slot, llvm_type->getPointerTo()));
+  }
+}
+
 llvm::Value *llvm_tuple_alloc(llvm::IRBuilder<> &builder,
                               llvm::Module *llvm_module,
                               const std::vector<llvm::Value *> llvm_dims) {
@@ -669,21 +968,10 @@ llvm::Value *llvm_tuple_alloc(llvm::IRBuilder<> &builder,
   } else {
     assert(llvm_module == llvm_get_module(builder));
 
-    llvm::Type *alloc_terms[] = {builder.getInt64Ty()};
     debug_above(6, log("need to allocate a tuple of type %s",
                        llvm_print(llvm_tuple_type).c_str()));
-    auto llvm_alloc_func_decl = llvm::cast<llvm::Function>(
-        llvm_module
-            ->getOrInsertFunction(
-                "ace_malloc",
-                llvm::FunctionType::get(builder.getInt8Ty()->getPointerTo(),
-                                        alloc_terms, false /*isVarArg*/))
-            .getCallee());
-    llvm::Value *llvm_allocated_tuple = builder.CreateBitCast(
-        builder.CreateCall(llvm_alloc_func_decl,
-                           std::vector<llvm::Value *>{
-                               llvm_sizeof_type(builder, llvm_tuple_type)}),
-        llvm_tuple_type->getPointerTo());
+    llvm::Value *llvm_allocated_tuple = llvm_alloc_managed(
+        builder, llvm_module, llvm_tuple_type);
 #ifdef ACE_DEBUG
     llvm_allocated_tuple->setName(
         string_format("tuple/%d", int(llvm_dims.size())));
@@ -776,6 +1064,24 @@ void destructure_closure(llvm::IRBuilder<> &builder,
   dbg_when(llvm_print(*llvm_function).find("badref") != std::string::npos);
 }
 
+llvm::Function *llvm_get_static_closure_function(llvm::Value *closure) {
+  auto llvm_global = llvm::dyn_cast<llvm::GlobalVariable>(
+      closure->stripPointerCasts());
+  if (llvm_global == nullptr || !llvm_global->isConstant() ||
+      !llvm_global->hasInitializer()) {
+    return nullptr;
+  }
+
+  auto llvm_closure_struct = llvm::dyn_cast<llvm::ConstantStruct>(
+      llvm_global->getInitializer());
+  if (llvm_closure_struct == nullptr ||
+      llvm_closure_struct->getNumOperands() != 2 ||
+      !llvm_closure_struct->getOperand(1)->isNullValue()) {
+    return nullptr;
+  }
+  return llvm::dyn_cast<llvm::Function>(llvm_closure_struct->getOperand(0));
+}
+
 llvm::Value *llvm_create_closure_callsite(Location location,
                                           llvm::IRBuilder<> &builder,
                                           llvm::Value *closure,
@@ -783,8 +1089,16 @@ llvm::Value *llvm_create_closure_callsite(Location location,
                                           std::vector<llvm::Value *> args) {
   assert(llvm_function_type != nullptr);
   assert(builder.GetInsertBlock() != nullptr);
-  llvm::Value *llvm_function_to_call = nullptr;
-  destructure_closure(builder, closure, &llvm_function_to_call, nullptr);
+  llvm::Value *llvm_function_to_call = llvm_get_static_closure_function(
+      closure);
+  if (llvm_function_to_call == nullptr ||
+      llvm::cast<llvm::Function>(llvm_function_to_call)->getFunctionType() !=
+          llvm_function_type) {
+    destructure_closure(builder, closure, &llvm_function_to_call, nullptr);
+  } else {
+    debug_above(4, log("calling %s directly",
+                       llvm_function_to_call->getName().str().c_str()));
+  }
 
   args.push_back(builder.CreateBitCast(
       closure, builder.getInt8Ty()->getPointerTo(), "closure_cast"));
@@ -1,4 +1,5 @@
 #pragma once
+#include "escape_analysis.h"
 #include "llvm_ace.h"
 #include "types.h"
 #include "ace.h"
@@ -77,6 +78,37 @@ llvm::StructType *llvm_create_struct_type(
 llvm::Value *llvm_tuple_alloc(llvm::IRBuilder<> &builder,
                               llvm::Module *llvm_module,
                               const std::vector<llvm::Value *> llvm_dims);
+
+/* the collector never scans allocations that hold no pointers, so those go
+ * through ace_malloc_atomic instead of ace_malloc. */
+bool llvm_type_contains_pointers(llvm::Type *llvm_type);
+llvm::Function *llvm_get_alloc_function(llvm::IRBuilder<> &builder,
+                                        llvm::Module *llvm_module,
+                                        llvm::Type *llvm_element_type);
+
+/* tuples whose fields fit in this many words are passed, returned and held
+ * in locals as first-class LLVM structs. bigger tuples live on the heap. */
+#define MAX_UNBOXED_TUPLE_WORDS 4
+bool llvm_is_unboxed_type(llvm::Type *llvm_type);
+/* unboxed values are boxed when they are handed to C, which only ever sees
+ * tuples by reference. */
+llvm::Type *llvm_storage_type(llvm::IRBuilder<> &builder,
+                              llvm::Type *llvm_type);
+/* builds a tuple as a struct value if it is small enough, otherwise as a heap
+ * allocation. */
+llvm::Value *llvm_tuple_create(llvm::IRBuilder<> &builder,
+                               llvm::Module *llvm_module,
+                               const std::vector<llvm::Value *> llvm_dims);
+/* copies an unboxed value to the heap and returns an i8* to it. */
+llvm::Value *llvm_box_value(llvm::IRBuilder<> &builder,
+                            llvm::Module *llvm_module,
+                            llvm::Value *llvm_value);
+/* like llvm_maybe_pointer_cast, but boxes or unboxes struct values as
+ * needed. this is what force casts (as!) lower to. */
+llvm::Value *llvm_convert_value(llvm::IRBuilder<> &builder,
+                                llvm::Module *llvm_module,
+                                llvm::Value *llvm_value,
+                                llvm::Type *llvm_type);
 llvm::Constant *llvm_sizeof_type(llvm::IRBuilder<> &builder,
                                  llvm::Type *llvm_type);
 llvm::Value *llvm_maybe_pointer_cast(llvm::IRBuilder<> &builder,
@@ -99,6 +131,31 @@ void check_struct_initialization(
 void llvm_verify_function(Location location, llvm::Function *llvm_function);
 void llvm_verify_module(llvm::Module &llvm_module);
 
+/* the in-process backend. the module is optimized and lowered without ever
+ * being printed as text. */
+enum OptLevel {
+  ol_O0,
+  ol_O1,
+  ol_O2,
+  ol_O3,
+};
+
+std::unique_ptr<llvm::TargetMachine> llvm_create_host_target_machine(
+    OptLevel opt_level);
+/* sets the module's target triple and data layout, then runs the new pass
+ * manager's default pipeline for |opt_level|. heap allocations that never
+ * escape are moved to the stack before and after the pipeline, and listed in
+ * |demoted_allocations|. */
+void llvm_optimize_module(llvm::Module &llvm_module,
+                          llvm::TargetMachine &target_machine,
+                          OptLevel opt_level,
+                          std::vector<DemotedAllocation> &demoted_allocations);
+void llvm_write_ll_file(llvm::Module &llvm_module, std::string filename);
+void llvm_write_bitcode_file(llvm::Module &llvm_module, std::string filename);
+void llvm_write_object_file(llvm::Module &llvm_module,
+                            llvm::TargetMachine &target_machine,
+                            std::string filename);
+
 /* flags for llvm_create_if_branch that tell it whether to invoke release_vars
  * for either branch */
 
@@ -140,6 +197,13 @@ void explain(llvm::Type *llvm_type);
 std::vector<llvm::Type *> llvm_get_types(
     const std::vector<llvm::Value *> &llvm_values);
 
+/* returns the function wrapped by one of the constant closures that
+ * gen_lambda makes for top-level functions and lambdas that capture nothing,
+ * or nullptr if closure is not known statically. */
+llvm::Function *llvm_get_static_closure_function(llvm::Value *closure);
+
+/* calls the function in closure. when the callee is known statically, this
+ * is a direct call that LLVM can inline. */
 llvm::Value *llvm_create_closure_callsite(Location location,
                                           llvm::IRBuilder<> &builder,
                                           llvm::Value *closure,
@@ -1,6 +1,9 @@
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -14,9 +17,11 @@
 #include "gen.h"
 #include "graph.h"
 #include "host.h"
+#include "jit.h"
 #include "lexer.h"
 #include "logger.h"
 #include "logger_decls.h"
+#include "module_cache.h"
 #include "solver.h"
 #include "tarjan.h"
 #include "testing.h"
@@ -50,6 +55,7 @@ bool debug_specialized_env = getenv("SHOW_ENV2") != nullptr;
 bool debug_types = getenv("SHOW_TYPES") != nullptr;
 bool debug_all_expr_types = getenv("SHOW_EXPR_TYPES") != nullptr;
 bool debug_all_translated_defns = getenv("SHOW_DEFN_TYPES") != nullptr;
+bool debug_demoted_allocations = getenv("SHOW_DEMOTED_ALLOCS") != nullptr;
 
 int run_program(std::string executable, std::vector<std::string> args) {
   pid_t pid = fork();
@@ -1090,28 +1096,29 @@ Phase3 specialize(const Phase2 &phase_2) {
 
 struct Phase4 {
   Phase4(const Phase4 &) = delete;
-  Phase4(Phase3 phase_3,
-         gen::GenEnv &&gen_env,
-         llvm::Module *llvm_module,
-         std::string output_llvm_filename)
-      : phase_3(phase_3), gen_env(std::move(gen_env)), llvm_module(llvm_module),
-        output_llvm_filename(output_llvm_filename) {
+  Phase4(Phase3 phase_3, gen::GenEnv &&gen_env, llvm::Module *llvm_module)
+      : phase_3(phase_3), gen_env(std::move(gen_env)),
+        llvm_module(llvm_module) {
   }
   Phase4(Phase4 &&rhs)
       : phase_3(rhs.phase_3), gen_env(std::move(rhs.gen_env)),
-        llvm_module(rhs.llvm_module),
-        output_llvm_filename(rhs.output_llvm_filename) {
+        llvm_module(rhs.llvm_module) {
     rhs.llvm_module = nullptr;
   }
   ~Phase4() {
     delete llvm_module;
-    // FUTURE: unlink(output_llvm_filename.c_str());
   }
 
   Phase3 phase_3;
   gen::GenEnv gen_env;
   llvm::Module *llvm_module = nullptr;
-  std::string output_llvm_filename;
+
+  /* where to put intermediate build products, like the object file */
+  std::string get_temp_filename(std::string extension) const {
+    auto temp_dir = std::string(getenv("TMPDIR") ? getenv("TMPDIR") : ".");
+    return temp_dir + "/" + phase_3.phase_2.compilation->program_name +
+           extension;
+  }
 
   std::ostream &dump(std::ostream &os) {
     return os << llvm_print_module(*llvm_module);
@@ -1212,10 +1219,13 @@ void write_main_block(llvm::IRBuilder<> &builder,
 
 Phase4 ssa_gen(llvm::LLVMContext &context, const Phase3 &phase_3) {
   llvm::Module *llvm_module = new llvm::Module("program", context);
+  /* codegen needs real type sizes (see llvm_convert_value), and both run and
+   * jit target the host */
+  llvm_module->setDataLayout(
+      llvm_create_host_target_machine(ol_O0)->createDataLayout());
   llvm::IRBuilder<> builder(context);
 
   gen::GenEnv gen_env;
-  std::string output_filename;
 
   try {
     const std::unordered_set<std::string> globals = get_globals(phase_3);
@@ -1352,23 +1362,13 @@ Phase4 ssa_gen(llvm::LLVMContext &context, const Phase3 &phase_3) {
     write_main_block(builder, llvm_module, gen_env, main_closure,
                      llvm_main_function);
 
-    auto temp_dir = std::string(getenv("TMPDIR") ? getenv("TMPDIR") : ".");
-    output_filename = temp_dir + "/" +
-                      phase_3.phase_2.compilation->program_name + ".ll";
-
     llvm_verify_module(*llvm_module);
-
-    std::ofstream ofs;
-    ofs.open(output_filename.c_str(), std::ofstream::out);
-    ofs << llvm_print_module(*llvm_module) << std::endl;
-    ofs.close();
-
   } catch (user_error &e) {
     print_exception(e);
     /* and continue */
   }
 
-  return Phase4(phase_3, std::move(gen_env), llvm_module, output_filename);
+  return Phase4(phase_3, std::move(gen_env), llvm_module);
 }
 
 struct Job {
@@ -1377,33 +1377,154 @@ struct Job {
   std::vector<std::string> args;
 };
 
-bool build_binary(const Job &job, bool explain, std::string &program_name) {
-  if (explain) {
-    std::cout << "build: compiles, specializes, generates LLVM output, then "
-                 "links a binary executable"
-              << std::endl;
-    return false;
+OptLevel get_opt_level(const Job &job) {
+  /* the last -O flag wins, like it does for clang */
+  OptLevel opt_level = ol_O0;
+  for (auto &opt : job.opts) {
+    if (opt == "-O0") {
+      opt_level = ol_O0;
+    } else if (opt == "-O1") {
+      opt_level = ol_O1;
+    } else if (opt == "-O2") {
+      opt_level = ol_O2;
+    } else if (opt == "-O3") {
+      opt_level = ol_O3;
+    }
   }
+  return opt_level;
+}
 
-  bool graph_deps = in_vector("-graph", job.opts);
+enum GcFlagKind {
+  gc_switch,
+  gc_count,
+  gc_size,
+};
 
-  llvm::LLVMContext context;
-  Phase4 phase_4 = ssa_gen(context,
-                           specialize(compile(job.args[0], graph_deps)));
+struct GcFlag {
+  const char *flag;
+  /* the runtime's environment variable, and the macro that holds its default
+   * in a built program. see runtime/ace_rt.c. */
+  const char *setting;
+  GcFlagKind kind;
+};
 
-  if (user_error::errors_occurred()) {
-    return false;
+const GcFlag gc_flags[] = {
+    {"-gc-parallel-markers", "ACE_GC_MARKERS", gc_count},
+    {"-gc-incremental", "ACE_GC_INCREMENTAL", gc_switch},
+    {"-gc-initial-heap", "ACE_GC_INITIAL_HEAP", gc_size},
+    {"-gc-free-space-divisor", "ACE_GC_FREE_SPACE_DIVISOR", gc_count},
+    {"-gc-max-heap", "ACE_GC_MAX_HEAP", gc_size},
+    {"-gc-stats", "ACE_GC_STATS", gc_switch},
+};
+
+/* collects the -gc-* flags, like -gc-parallel-markers=4 or -gc-max-heap=2g,
+ * as the settings they stand for. the last one of each kind wins. */
+std::map<std::string, std::string> get_gc_settings(const Job &job) {
+  std::map<std::string, std::string> settings;
+  for (auto &opt : job.opts) {
+    if (!starts_with(opt, "-gc-")) {
+      continue;
+    }
+    auto equals = opt.find('=');
+    std::string name = opt.substr(0, equals);
+    std::string value = equals != std::string::npos ? opt.substr(equals + 1)
+                                                    : "";
+    const GcFlag *gc_flag = nullptr;
+    for (auto &candidate : gc_flags) {
+      if (name == candidate.flag) {
+        gc_flag = &candidate;
+      }
+    }
+    if (gc_flag == nullptr) {
+      throw user_error(INTERNAL_LOC(), "unknown collector flag %s",
+                       opt.c_str());
+    }
+
+    if (gc_flag->kind == gc_switch) {
+      if (equals != std::string::npos) {
+        throw user_error(INTERNAL_LOC(), "%s does not take a value",
+                         gc_flag->flag);
+      }
+      settings[gc_flag->setting] = "1";
+      continue;
+    }
+
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long n = strtoull(value.c_str(), &end, 10);
+    int shift = 0;
+    if (gc_flag->kind == gc_size && end != nullptr) {
+      switch (*end) {
+      case 'k':
+      case 'K':
+        shift = 10;
+        break;
+      case 'm':
+      case 'M':
+        shift = 20;
+        break;
+      case 'g':
+      case 'G':
+        shift = 30;
+        break;
+      }
+      if (shift != 0) {
+        ++end;
+      }
+    }
+    if (value.size() == 0 || !isdigit(value[0]) || *end != '\0' ||
+        errno != 0 || n > (ULLONG_MAX >> shift)) {
+      throw user_error(INTERNAL_LOC(), "%s needs %s, as in %s=%s",
+                       gc_flag->flag,
+                       gc_flag->kind == gc_size ? "a size" : "a count",
+                       gc_flag->flag,
+                       gc_flag->kind == gc_size ? "256m" : "4");
+    }
+    settings[gc_flag->setting] = string_format("%llu", n << shift);
   }
-  std::stringstream ss_c_flags;
-  std::stringstream ss_compilands;
-  std::stringstream ss_lib_flags;
+  return settings;
+}
+
+std::unique_ptr<llvm::TargetMachine> optimize_module(const Job &job,
+                                                     llvm::Module &llvm_module) {
+  OptLevel opt_level = get_opt_level(job);
+  auto target_machine = llvm_create_host_target_machine(opt_level);
+  std::vector<DemotedAllocation> demoted_allocations;
+  llvm_optimize_module(llvm_module, *target_machine, opt_level,
+                       demoted_allocations);
+
+  if (debug_demoted_allocations) {
+    for (auto &demoted_allocation : demoted_allocations) {
+      log("demoted %s (%d bytes) in %s to the stack",
+          demoted_allocation.type_name.c_str(), (int)demoted_allocation.size,
+          demoted_allocation.function_name.c_str());
+    }
+    log("demoted %d allocation sites to the stack",
+        (int)demoted_allocations.size());
+  }
+  return target_machine;
+}
+
+#ifdef __APPLE__
+#define CLANG "\"$(brew --prefix)/opt/llvm@11/bin/clang\""
+#else
+#define CLANG "clang"
+#endif
+
+void get_link_flags(const Compilation &compilation,
+                    bool static_libs,
+                    std::stringstream &ss_c_flags,
+                    std::stringstream &ss_compilands,
+                    std::stringstream &ss_lib_flags) {
   ss_compilands << "\"$ACE_RUNTIME/ace_rt.c\" ";
-  for (auto link_in : phase_4.phase_3.phase_2.compilation->link_ins) {
+  for (auto link_in : compilation.link_ins) {
     std::string link_text = unescape_json_quotes(link_in.name.text);
     switch (link_in.lit) {
     case lit_pkgconfig: {
       ss_c_flags << get_pkg_config("--cflags-only-I", link_text) << " ";
-      ss_lib_flags << get_pkg_config("--libs --static", link_text) << " ";
+      ss_lib_flags << get_pkg_config(static_libs ? "--libs --static" : "--libs",
+                                     link_text)
+                   << " ";
       break;
     }
     case lit_link:
@@ -1414,26 +1535,170 @@ bool build_binary(const Job &job, bool explain, std::string &program_name) {
       break;
     }
   }
+}
+
+/* the JIT needs the C runtime, and everything it links against, as a shared
+ * object. building one takes about as long as linking a binary, so it is kept
+ * in the cache dir keyed on the runtime sources and the link-ins. */
+std::string get_runtime_shared_object(const Compilation &compilation) {
+  std::string runtime_dir = getenv("ACE_RUNTIME");
+  std::vector<std::string> compilands{"ace_rt.c"};
+  uint64_t key = module_cache::fnv1a(module_cache::fnv1a_offset_basis,
+                                     ACE_VERSION);
+  key = module_cache::fnv1a(
+      key, getenv("ACE_OPT_FLAGS") ? getenv("ACE_OPT_FLAGS") : "");
+  for (auto &link_in : compilation.link_ins) {
+    key = module_cache::fnv1a(key, string_format("%d", (int)link_in.lit));
+    key = module_cache::fnv1a(key, link_in.name.text);
+    if (link_in.lit == lit_compile) {
+      compilands.push_back(unescape_json_quotes(link_in.name.text));
+    }
+  }
+  for (auto &compiland : compilands) {
+    std::ifstream ifs(runtime_dir + "/" + compiland);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    key = module_cache::fnv1a(key, compiland);
+    key = module_cache::fnv1a(key, ss.str());
+  }
+
+  std::string cache_dir = module_cache::get_cache_dir();
+  std::string filename;
+  std::string parent_dir = directory_from_file_path(cache_dir);
+  if (module_cache::enabled() &&
+      (parent_dir.size() == 0 || ensure_directory_exists(parent_dir)) &&
+      ensure_directory_exists(cache_dir)) {
+    filename = string_format("%s/rt-%016llx.so", cache_dir.c_str(),
+                             (unsigned long long)key);
+    if (file_exists(filename)) {
+      return filename;
+    }
+  } else {
+    auto temp_dir = std::string(getenv("TMPDIR") ? getenv("TMPDIR") : ".");
+    filename = temp_dir + "/" + compilation.program_name + "-rt.so";
+  }
 
+  std::stringstream ss_c_flags;
+  std::stringstream ss_compilands;
+  std::stringstream ss_lib_flags;
+  get_link_flags(compilation, false /*static_libs*/, ss_c_flags,
+                 ss_compilands, ss_lib_flags);
+
+  /* build next to the final name and move it into place so that concurrent
+   * runs never load a partially written object */
+  std::string temp_filename = string_format("%s.%d.tmp", filename.c_str(),
+                                            (int)getpid());
   auto command_line = string_format(
-  // We are using clang to lower the code from LLVM, and link it
-  // to the runtime.
+      CLANG " -shared -fPIC "
+      "%s "
 #ifdef __APPLE__
-      "\"$(brew --prefix)/opt/llvm@11/bin/clang\" "
-#else
-      "clang "
+      "-I \"$(xcrun --sdk macosx --show-sdk-path)/usr/include\" "
 #endif
+      "$ACE_OPT_FLAGS "
+      "-Wno-nullability-completeness "
+      "%s "
+#ifdef __APPLE__
+      "-L \"$(xcrun --sdk macosx --show-sdk-path)/usr/lib\" "
+#endif
+      "-lm %s "
+      "-o \"%s\"",
+      ss_c_flags.str().c_str(), ss_compilands.str().c_str(),
+      ss_lib_flags.str().c_str(), temp_filename.c_str());
+  if (debug_compile_step) {
+    log("running %s", command_line.c_str());
+  }
+  if (std::system(command_line.c_str()) != 0) {
+    unlink(temp_filename.c_str());
+    throw user_error(INTERNAL_LOC(), "failed to compile the runtime");
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    unlink(temp_filename.c_str());
+    throw user_error(INTERNAL_LOC(), "failed to move %s into place",
+                     filename.c_str());
+  }
+  return filename;
+}
+
+int jit_program(const Job &job) {
+  bool graph_deps = in_vector("-graph", job.opts);
+
+  auto llvm_context = std::make_unique<llvm::LLVMContext>();
+  Phase4 phase_4 = ssa_gen(*llvm_context,
+                           specialize(compile(job.args[0], graph_deps)));
+
+  if (user_error::errors_occurred()) {
+    return EXIT_FAILURE;
+  }
+
+  optimize_module(job, *phase_4.llvm_module);
+
+  const Compilation &compilation = *phase_4.phase_3.phase_2.compilation;
+  std::string runtime_shared_object = get_runtime_shared_object(compilation);
+
+  /* the program runs in this process, so the collector flags can go straight
+   * into the environment the runtime reads, without outranking what is
+   * already there. */
+  for (auto &setting : get_gc_settings(job)) {
+    setenv(setting.first.c_str(), setting.second.c_str(), false /*overwrite*/);
+  }
+
+  /* the JIT takes ownership of the module and its context */
+  std::unique_ptr<llvm::Module> llvm_module(phase_4.llvm_module);
+  phase_4.llvm_module = nullptr;
+  return jit_run_module(std::move(llvm_context), std::move(llvm_module),
+                        {runtime_shared_object}, compilation.program_name,
+                        vec_slice(job.args, 1, job.args.size()));
+}
+
+bool build_binary(const Job &job, bool explain, std::string &program_name) {
+  if (explain) {
+    std::cout << "build: compiles, specializes, generates LLVM output, then "
+                 "links a binary executable. -O[0-3] sets the optimization "
+                 "level, and -gc-* flags set the collector's defaults"
+              << std::endl;
+    return false;
+  }
+
+  bool graph_deps = in_vector("-graph", job.opts);
+  std::stringstream ss_gc_defines;
+  for (auto &setting : get_gc_settings(job)) {
+    ss_gc_defines << "-D" << setting.first << "=" << setting.second << " ";
+  }
+
+  llvm::LLVMContext context;
+  Phase4 phase_4 = ssa_gen(context,
+                           specialize(compile(job.args[0], graph_deps)));
+
+  if (user_error::errors_occurred()) {
+    return false;
+  }
+
+  /* optimize and lower the module in-process. clang only compiles the runtime
+   * and links. */
+  auto target_machine = optimize_module(job, *phase_4.llvm_module);
+  std::string object_filename = phase_4.get_temp_filename(".o");
+  llvm_write_object_file(*phase_4.llvm_module, *target_machine,
+                         object_filename);
+
+  std::stringstream ss_c_flags;
+  std::stringstream ss_compilands;
+  std::stringstream ss_lib_flags;
+  get_link_flags(*phase_4.phase_3.phase_2.compilation, true /*static_libs*/,
+                 ss_c_flags, ss_compilands, ss_lib_flags);
+
+  auto command_line = string_format(
+      // We are using clang to compile the runtime, and link it to our object
+      // file.
+      CLANG " "
       // Include any necessary include dirs for C dependencies.
       "%s "
+      // Bake in the collector settings from any -gc-* flags.
+      "%s "
 #ifdef __APPLE__
       "-I \"$(xcrun --sdk macosx --show-sdk-path)/usr/include\" "
 #endif
-      // Allow for the user to specify optimizations
+      // Allow for the user to specify optimizations of the runtime
       "$ACE_OPT_FLAGS "
-      // NB: we don't embed the target triple into the LL, so any
-      // targeted triple causes an ugly error from clang, so I just
-      // ignore it here.
-      "-Wno-override-module "
       // HACKHACK: temporary workaround to allow libsodium to compile
       "-Wno-nullability-completeness "
       // TODO: plumb host targeting through clang here
@@ -1445,12 +1710,13 @@ bool build_binary(const Job &job, bool explain, std::string &program_name) {
       "-L \"$(xcrun --sdk macosx --show-sdk-path)/usr/lib\" "
 #endif
       "-lm %s "
-      // Don't forget the built .ll file from our frontend here.
+      // Don't forget the object file from our frontend here.
       "%s "
       // Give the binary a name.
       "-o %s",
-      ss_c_flags.str().c_str(), ss_compilands.str().c_str(),
-      ss_lib_flags.str().c_str(), phase_4.output_llvm_filename.c_str(),
+      ss_c_flags.str().c_str(), ss_gc_defines.str().c_str(),
+      ss_compilands.str().c_str(), ss_lib_flags.str().c_str(),
+      object_filename.c_str(),
       phase_4.phase_3.phase_2.compilation->program_name.c_str(),
       phase_4.phase_3.phase_2.compilation->program_name.c_str());
   if (debug_compile_step) {
@@ -1473,6 +1739,8 @@ int run_job(const Job &job) {
                          in_vector("-show-expr-types", job.opts);
   debug_all_translated_defns = (getenv("SHOW_DEFN_TYPES") != nullptr) ||
                                in_vector("-show-defn-types", job.opts);
+  debug_demoted_allocations = (getenv("SHOW_DEMOTED_ALLOCS") != nullptr) ||
+                              in_vector("-show-demoted-allocs", job.opts);
   if (in_vector("-n", job.opts)) {
     setenv("NO_PRELUDE", "1", true /*overwrite*/);
   }
@@ -1645,7 +1913,8 @@ int run_job(const Job &job) {
   };
   cmd_map["ll"] = [&](const Job &job, bool explain) {
     if (explain) {
-      std::cout << "ll: compiles, specializes, then generates LLVM output"
+      std::cout << "ll: compiles, specializes, then generates LLVM output. "
+                   "-O[0-3] optimizes it, -emit-bc writes bitcode"
                 << std::endl;
       return EXIT_FAILURE;
     }
@@ -1656,20 +1925,38 @@ int run_job(const Job &job) {
       llvm::LLVMContext context;
       Phase4 phase_4 = ssa_gen(context,
                                specialize(compile(job.args[0], graph_deps)));
+      if (user_error::errors_occurred()) {
+        return EXIT_FAILURE;
+      }
 
-      std::cout << phase_4.output_llvm_filename << std::endl;
-      return user_error::errors_occurred() ? EXIT_FAILURE : EXIT_SUCCESS;
+      optimize_module(job, *phase_4.llvm_module);
+
+      std::string output_filename;
+      if (in_vector("-emit-bc", job.opts)) {
+        output_filename = phase_4.get_temp_filename(".bc");
+        llvm_write_bitcode_file(*phase_4.llvm_module, output_filename);
+      } else {
+        output_filename = phase_4.get_temp_filename(".ll");
+        llvm_write_ll_file(*phase_4.llvm_module, output_filename);
+      }
+      std::cout << output_filename << std::endl;
+      return EXIT_SUCCESS;
     }
   };
 
   cmd_map["run"] = [&](const Job &job, bool explain) {
     if (explain) {
       std::cout << "run: compiles, specializes, generates LLVM output, then "
-                   "runs the generated binary"
+                   "runs the generated binary. -jit runs it in-process "
+                   "instead"
                 << std::endl;
       return EXIT_FAILURE;
     }
 
+    if (in_vector("-jit", job.opts)) {
+      return jit_program(job);
+    }
+
     std::string program_name;
     if (build_binary(job, false /*explain*/, program_name)) {
       return run_program(program_name, vec_slice(job.args, 1, job.args.size()));
@@ -1678,6 +1965,17 @@ int run_job(const Job &job) {
     }
   };
 
+  cmd_map["jit"] = [&](const Job &job, bool explain) {
+    if (explain) {
+      std::cout << "jit: compiles, specializes, generates LLVM output, then "
+                   "runs it in-process with the ORC JIT"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    return jit_program(job);
+  };
+
   cmd_map["build"] = [&](const Job &job, bool explain) {
     std::string program_name;
     if (build_binary(job, explain, program_name)) {
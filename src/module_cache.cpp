@@ -0,0 +1,1106 @@
+#include "module_cache.h"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+#include "ast.h"
+#include "compiler.h"
+#include "dbg.h"
+#include "disk.h"
+#include "logger.h"
+#include "ptr.h"
+#include "utils.h"
+
+#ifndef ACE_VERSION
+#define ACE_VERSION "unknown"
+#endif
+
+namespace ace {
+namespace module_cache {
+
+using namespace ast;
+
+namespace {
+
+/* bump this whenever the serialization below changes shape */
+const uint32_t format_version = 1;
+const char magic[4] = {'A', 'C', 'E', 'M'};
+
+enum Tag : uint8_t {
+  tag_null = 0,
+  tag_backref,
+
+  /* expressions */
+  tag_static_print,
+  tag_var,
+  tag_match,
+  tag_block,
+  tag_as,
+  tag_sizeof,
+  tag_application,
+  tag_lambda,
+  tag_let,
+  tag_tuple,
+  tag_tuple_deref,
+  tag_ffi,
+  tag_builtin,
+  tag_literal,
+  tag_conditional,
+  tag_return,
+  tag_continue,
+  tag_break,
+  tag_defer,
+  tag_while,
+
+  /* predicates */
+  tag_tuple_predicate,
+  tag_irrefutable_predicate,
+  tag_ctor_predicate,
+
+  /* types */
+  tag_type_variable,
+  tag_type_id,
+  tag_type_operator,
+  tag_type_tuple,
+  tag_type_params,
+  tag_type_lambda,
+};
+
+struct corrupt_cache {};
+
+std::string get_cache_filename(uint64_t key) {
+  return get_cache_dir() + string_format("/%016llx.acem",
+                                         (unsigned long long)key);
+}
+
+/* names handed out by gensym_name() and ast::fresh() are only unique within a
+ * single run of the compiler. */
+bool is_generated_name(const std::string &name) {
+  if (name.size() < 3 || name[0] != '_' || name[1] != '_') {
+    return false;
+  }
+  if (name[2] == 'v' && name.size() > 3 && isdigit(name[3])) {
+    for (size_t i = 3; i < name.size(); ++i) {
+      if (!isdigit(name[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  for (size_t i = 2; i < name.size(); ++i) {
+    if (name[i] < 'a' || name[i] > 'z') {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct Writer {
+  std::string body;
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint64_t> string_ids;
+  std::unordered_map<const void *, uint64_t> exprs_seen;
+  std::unordered_map<const void *, uint64_t> predicates_seen;
+  std::unordered_map<const void *, uint64_t> types_seen;
+
+  void write_varint(std::string &out, uint64_t x) {
+    while (x >= 0x80) {
+      out.push_back(char((x & 0x7f) | 0x80));
+      x >>= 7;
+    }
+    out.push_back(char(x));
+  }
+
+  void u(uint64_t x) {
+    write_varint(body, x);
+  }
+
+  void i(int64_t x) {
+    /* zigzag so that small negative numbers (like line -1) stay small */
+    u((uint64_t(x) << 1) ^ uint64_t(x >> 63));
+  }
+
+  void tag(Tag t) {
+    body.push_back(char(t));
+  }
+
+  void str(const std::string &s) {
+    auto iter = string_ids.find(s);
+    if (iter != string_ids.end()) {
+      u(iter->second);
+    } else {
+      uint64_t id = strings.size();
+      strings.push_back(s);
+      string_ids[s] = id;
+      u(id);
+    }
+  }
+
+  /* returns true if |p| has already been written, in which case a reference
+   * to it has been emitted. */
+  bool backref(std::unordered_map<const void *, uint64_t> &seen,
+               const void *p) {
+    auto iter = seen.find(p);
+    if (iter == seen.end()) {
+      return false;
+    }
+    tag(tag_backref);
+    u(iter->second);
+    return true;
+  }
+
+  void location(const Location &location) {
+    str(location.filename);
+    i(location.line);
+    i(location.col);
+  }
+
+  void identifier(const Identifier &id) {
+    str(id.name);
+    location(id.location);
+  }
+
+  void identifiers(const Identifiers &ids) {
+    u(ids.size());
+    for (auto &id : ids) {
+      identifier(id);
+    }
+  }
+
+  void maybe_identifier(const maybe<Identifier> &id) {
+    u(id.valid);
+    if (id.valid) {
+      identifier(id.t);
+    }
+  }
+
+  void token(const Token &token) {
+    location(token.location);
+    u(token.tk);
+    str(token.text);
+  }
+
+  void type(const types::Ref &type) {
+    if (type == nullptr) {
+      tag(tag_null);
+      return;
+    } else if (backref(types_seen, type.get())) {
+      return;
+    }
+
+    if (auto tv = dyncast<const types::TypeVariable>(type)) {
+      tag(tag_type_variable);
+      identifier(tv->id);
+    } else if (auto ti = dyncast<const types::TypeId>(type)) {
+      tag(tag_type_id);
+      identifier(ti->id);
+    } else if (auto to = dyncast<const types::TypeOperator>(type)) {
+      tag(tag_type_operator);
+      this->type(to->oper);
+      this->type(to->operand);
+    } else if (auto tt = dyncast<const types::TypeTuple>(type)) {
+      tag(tag_type_tuple);
+      location(tt->location);
+      types(tt->dimensions);
+    } else if (auto tp = dyncast<const types::TypeParams>(type)) {
+      tag(tag_type_params);
+      location(tp->location);
+      types(tp->dimensions);
+    } else if (auto tl = dyncast<const types::TypeLambda>(type)) {
+      tag(tag_type_lambda);
+      identifier(tl->binding);
+      this->type(tl->body);
+    } else {
+      assert(false);
+    }
+
+    uint64_t id = types_seen.size();
+    types_seen[type.get()] = id;
+  }
+
+  void types(const types::Refs &types) {
+    u(types.size());
+    for (auto &type : types) {
+      this->type(type);
+    }
+  }
+
+  void type_map(const types::Map &map) {
+    u(map.size());
+    for (auto &pair : map) {
+      str(pair.first);
+      type(pair.second);
+    }
+  }
+
+  void class_predicate(const types::ClassPredicateRef &class_predicate) {
+    identifier(class_predicate->classname);
+    types(class_predicate->params);
+  }
+
+  void predicate(const Predicate *predicate) {
+    if (backref(predicates_seen, predicate)) {
+      return;
+    }
+
+    if (auto p = dcast<const TuplePredicate *>(predicate)) {
+      tag(tag_tuple_predicate);
+      location(p->location);
+      predicates(p->params);
+      maybe_identifier(p->name_assignment);
+    } else if (auto p = dcast<const IrrefutablePredicate *>(predicate)) {
+      tag(tag_irrefutable_predicate);
+      location(p->location);
+      maybe_identifier(p->name_assignment);
+    } else if (auto p = dcast<const CtorPredicate *>(predicate)) {
+      tag(tag_ctor_predicate);
+      location(p->location);
+      predicates(p->params);
+      identifier(p->ctor_name);
+      maybe_identifier(p->name_assignment);
+    } else if (auto p = dcast<const Literal *>(predicate)) {
+      tag(tag_literal);
+      token(p->token);
+    } else {
+      assert(false);
+    }
+
+    uint64_t id = predicates_seen.size();
+    predicates_seen[predicate] = id;
+  }
+
+  void predicates(const std::vector<const Predicate *> &predicates) {
+    u(predicates.size());
+    for (auto predicate : predicates) {
+      this->predicate(predicate);
+    }
+  }
+
+  void expr(const Expr *expr) {
+    if (expr == nullptr) {
+      tag(tag_null);
+      return;
+    } else if (backref(exprs_seen, expr)) {
+      return;
+    }
+
+    if (auto static_print = dcast<const StaticPrint *>(expr)) {
+      tag(tag_static_print);
+      location(static_print->location);
+      this->expr(static_print->expr);
+    } else if (auto var = dcast<const Var *>(expr)) {
+      tag(tag_var);
+      identifier(var->id);
+    } else if (auto match = dcast<const Match *>(expr)) {
+      tag(tag_match);
+      this->expr(match->scrutinee);
+      u(match->pattern_blocks.size());
+      for (auto pattern_block : match->pattern_blocks) {
+        predicate(pattern_block->predicate);
+        this->expr(pattern_block->result);
+      }
+      u(match->disable_coverage_check);
+    } else if (auto block = dcast<const Block *>(expr)) {
+      tag(tag_block);
+      exprs(block->statements);
+    } else if (auto as = dcast<const As *>(expr)) {
+      tag(tag_as);
+      this->expr(as->expr);
+      type(as->type);
+      u(as->force_cast);
+    } else if (auto sizeof_ = dcast<const Sizeof *>(expr)) {
+      tag(tag_sizeof);
+      location(sizeof_->location);
+      type(sizeof_->type);
+    } else if (auto application = dcast<const Application *>(expr)) {
+      tag(tag_application);
+      this->expr(application->a);
+      exprs(application->params);
+    } else if (auto lambda = dcast<const Lambda *>(expr)) {
+      tag(tag_lambda);
+      identifiers(lambda->vars);
+      this->expr(lambda->body);
+      types(lambda->param_types);
+      type(lambda->return_type);
+    } else if (auto let = dcast<const Let *>(expr)) {
+      tag(tag_let);
+      identifier(let->var);
+      this->expr(let->value);
+      this->expr(let->body);
+    } else if (auto tuple = dcast<const Tuple *>(expr)) {
+      tag(tag_tuple);
+      location(tuple->location);
+      exprs(tuple->dims);
+    } else if (auto tuple_deref = dcast<const TupleDeref *>(expr)) {
+      tag(tag_tuple_deref);
+      this->expr(tuple_deref->expr);
+      i(tuple_deref->index);
+      i(tuple_deref->max);
+    } else if (auto ffi = dcast<const FFI *>(expr)) {
+      tag(tag_ffi);
+      identifier(ffi->id);
+      exprs(ffi->exprs);
+    } else if (auto builtin = dcast<const Builtin *>(expr)) {
+      tag(tag_builtin);
+      identifier(builtin->var->id);
+      exprs(builtin->exprs);
+    } else if (auto literal = dcast<const Literal *>(expr)) {
+      tag(tag_literal);
+      token(literal->token);
+    } else if (auto conditional = dcast<const Conditional *>(expr)) {
+      tag(tag_conditional);
+      this->expr(conditional->cond);
+      this->expr(conditional->truthy);
+      this->expr(conditional->falsey);
+    } else if (auto ret = dcast<const ReturnStatement *>(expr)) {
+      tag(tag_return);
+      this->expr(ret->value);
+    } else if (auto continue_ = dcast<const Continue *>(expr)) {
+      tag(tag_continue);
+      location(continue_->location);
+    } else if (auto break_ = dcast<const Break *>(expr)) {
+      tag(tag_break);
+      location(break_->location);
+    } else if (auto defer = dcast<const Defer *>(expr)) {
+      tag(tag_defer);
+      this->expr(defer->application);
+    } else if (auto while_ = dcast<const While *>(expr)) {
+      tag(tag_while);
+      this->expr(while_->condition);
+      this->expr(while_->block);
+    } else {
+      assert(false);
+    }
+
+    uint64_t id = exprs_seen.size();
+    exprs_seen[expr] = id;
+  }
+
+  void exprs(const std::vector<const Expr *> &exprs) {
+    u(exprs.size());
+    for (auto expr : exprs) {
+      this->expr(expr);
+    }
+  }
+
+  void decl(const Decl *decl) {
+    identifier(decl->id);
+    expr(decl->value);
+  }
+
+  void decls(const std::vector<const Decl *> &decls) {
+    u(decls.size());
+    for (auto decl : decls) {
+      this->decl(decl);
+    }
+  }
+
+  void module(const Module *module) {
+    str(module->name);
+    identifiers(module->imports);
+    decls(module->decls);
+
+    u(module->type_decls.size());
+    for (auto type_decl : module->type_decls) {
+      identifier(type_decl->id);
+      identifiers(type_decl->params);
+    }
+
+    u(module->type_classes.size());
+    for (auto type_class : module->type_classes) {
+      identifier(type_class->id);
+      identifiers(type_class->type_var_ids);
+      u(type_class->class_predicates.size());
+      for (auto &class_predicate : type_class->class_predicates) {
+        this->class_predicate(class_predicate);
+      }
+      type_map(type_class->overloads);
+      decls(type_class->default_decls);
+    }
+
+    u(module->instances.size());
+    for (auto instance : module->instances) {
+      class_predicate(instance->class_predicate);
+      decls(instance->decls);
+    }
+
+    u(module->ctor_id_map.size());
+    for (auto &pair : module->ctor_id_map) {
+      str(pair.first);
+      i(pair.second);
+    }
+
+    u(module->data_ctors_map.size());
+    for (auto &pair : module->data_ctors_map) {
+      str(pair.first);
+      type_map(pair.second);
+    }
+
+    type_map(module->type_env);
+  }
+
+  void artifacts(const ModuleArtifacts &artifacts) {
+    module(artifacts.module);
+
+    u(artifacts.dependencies.size());
+    for (auto &dependency : artifacts.dependencies) {
+      identifier(dependency);
+    }
+
+    u(artifacts.symbol_exports.size());
+    for (auto &pair : artifacts.symbol_exports) {
+      identifier(pair.first);
+      identifier(pair.second);
+    }
+
+    u(artifacts.symbol_imports.size());
+    for (auto &pair : artifacts.symbol_imports) {
+      str(pair.first);
+      u(pair.second.size());
+      for (auto &symbol : pair.second) {
+        identifier(symbol);
+      }
+    }
+
+    u(artifacts.link_ins.size());
+    for (auto &link_in : artifacts.link_ins) {
+      u(link_in.lit);
+      token(link_in.name);
+    }
+
+    u(artifacts.comments.size());
+    for (auto &comment : artifacts.comments) {
+      token(comment);
+    }
+  }
+
+  std::string finish(uint64_t key) {
+    std::string out(magic, sizeof(magic));
+    write_varint(out, format_version);
+    write_varint(out, key);
+    write_varint(out, strings.size());
+    for (auto &s : strings) {
+      write_varint(out, s.size());
+      out.append(s);
+    }
+    out.append(body);
+    return out;
+  }
+};
+
+struct Reader {
+  Reader(const std::string &data) : data(data) {
+  }
+
+  const std::string &data;
+  size_t pos = 0;
+  std::vector<std::string> strings;
+  std::vector<const Expr *> exprs_seen;
+  std::vector<const Predicate *> predicates_seen;
+  std::vector<types::Ref> types_seen;
+
+  uint64_t u() {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= data.size()) {
+        throw corrupt_cache{};
+      }
+      uint8_t byte = data[pos++];
+      x |= uint64_t(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return x;
+      }
+    }
+    throw corrupt_cache{};
+  }
+
+  int64_t i() {
+    uint64_t x = u();
+    return int64_t(x >> 1) ^ -int64_t(x & 1);
+  }
+
+  bool b() {
+    return u() != 0;
+  }
+
+  /* the number of elements in a collection. every element takes at least one
+   * byte, so anything larger than what remains is corrupt. */
+  size_t count() {
+    uint64_t n = u();
+    if (n > data.size() - pos) {
+      throw corrupt_cache{};
+    }
+    return n;
+  }
+
+  Tag tag() {
+    if (pos >= data.size()) {
+      throw corrupt_cache{};
+    }
+    return Tag(uint8_t(data[pos++]));
+  }
+
+  const std::string &str() {
+    uint64_t id = u();
+    if (id >= strings.size()) {
+      throw corrupt_cache{};
+    }
+    return strings[id];
+  }
+
+  template <typename T> T backref(const std::vector<T> &seen) {
+    uint64_t id = u();
+    if (id >= seen.size()) {
+      throw corrupt_cache{};
+    }
+    return seen[id];
+  }
+
+  void header(uint64_t key) {
+    if (data.size() < sizeof(magic) ||
+        data.compare(0, sizeof(magic), magic, sizeof(magic)) != 0) {
+      throw corrupt_cache{};
+    }
+    pos = sizeof(magic);
+    if (u() != format_version || u() != key) {
+      throw corrupt_cache{};
+    }
+
+    size_t string_count = count();
+    strings.reserve(string_count);
+    std::unordered_map<std::string, std::string> renames;
+    for (size_t index = 0; index < string_count; ++index) {
+      size_t size = count();
+      std::string s = data.substr(pos, size);
+      pos += size;
+      if (is_generated_name(s)) {
+        auto &rename = renames[s];
+        if (rename.size() == 0) {
+          rename = (s[2] == 'v' && isdigit(s[3])) ? ast::fresh()
+                                                  : gensym_name();
+        }
+        s = rename;
+      }
+      strings.push_back(s);
+    }
+  }
+
+  Location location() {
+    std::string filename = str();
+    int line = i();
+    int col = i();
+    return Location{filename, line, col};
+  }
+
+  Identifier identifier() {
+    std::string name = str();
+    return Identifier{name, location()};
+  }
+
+  Identifiers identifiers() {
+    Identifiers ids;
+    size_t n = count();
+    ids.reserve(n);
+    for (size_t index = 0; index < n; ++index) {
+      ids.push_back(identifier());
+    }
+    return ids;
+  }
+
+  maybe<Identifier> maybe_identifier() {
+    if (b()) {
+      return maybe<Identifier>(identifier());
+    } else {
+      return maybe<Identifier>();
+    }
+  }
+
+  Token token() {
+    Location location = this->location();
+    TokenKind tk = TokenKind(u());
+    return Token{location, tk, str()};
+  }
+
+  types::Ref type() {
+    types::Ref type;
+    switch (tag()) {
+    case tag_null:
+      return nullptr;
+    case tag_backref:
+      return backref(types_seen);
+    case tag_type_variable:
+      type = type_variable(identifier());
+      break;
+    case tag_type_id:
+      type = type_id(identifier());
+      break;
+    case tag_type_operator: {
+      auto oper = this->type();
+      auto operand = this->type();
+      type = type_operator(oper, operand);
+      break;
+    }
+    case tag_type_tuple: {
+      auto location = this->location();
+      type = type_tuple(location, types());
+      break;
+    }
+    case tag_type_params: {
+      auto location = this->location();
+      type = std::make_shared<types::TypeParams>(location, types());
+      break;
+    }
+    case tag_type_lambda: {
+      auto binding = identifier();
+      type = type_lambda(binding, this->type());
+      break;
+    }
+    default:
+      throw corrupt_cache{};
+    }
+    types_seen.push_back(type);
+    return type;
+  }
+
+  types::Refs types() {
+    types::Refs types;
+    size_t n = count();
+    types.reserve(n);
+    for (size_t index = 0; index < n; ++index) {
+      types.push_back(type());
+    }
+    return types;
+  }
+
+  types::Map type_map() {
+    types::Map map;
+    size_t n = count();
+    for (size_t index = 0; index < n; ++index) {
+      std::string key = str();
+      map[key] = type();
+    }
+    return map;
+  }
+
+  types::ClassPredicateRef class_predicate() {
+    auto classname = identifier();
+    return std::make_shared<types::ClassPredicate>(classname, types());
+  }
+
+  const Predicate *predicate() {
+    const Predicate *predicate = nullptr;
+    switch (tag()) {
+    case tag_backref:
+      return backref(predicates_seen);
+    case tag_tuple_predicate: {
+      auto location = this->location();
+      auto params = predicates();
+      predicate = new TuplePredicate(location, params, maybe_identifier());
+      break;
+    }
+    case tag_irrefutable_predicate: {
+      auto location = this->location();
+      predicate = new IrrefutablePredicate(location, maybe_identifier());
+      break;
+    }
+    case tag_ctor_predicate: {
+      auto location = this->location();
+      auto params = predicates();
+      auto ctor_name = identifier();
+      predicate = new CtorPredicate(location, params, ctor_name,
+                                    maybe_identifier());
+      break;
+    }
+    case tag_literal:
+      predicate = new Literal(token());
+      break;
+    default:
+      throw corrupt_cache{};
+    }
+    predicates_seen.push_back(predicate);
+    return predicate;
+  }
+
+  std::vector<const Predicate *> predicates() {
+    std::vector<const Predicate *> predicates;
+    size_t n = count();
+    predicates.reserve(n);
+    for (size_t index = 0; index < n; ++index) {
+      predicates.push_back(predicate());
+    }
+    return predicates;
+  }
+
+  const Expr *expr() {
+    const Expr *expr = nullptr;
+    switch (tag()) {
+    case tag_null:
+      return nullptr;
+    case tag_backref:
+      return backref(exprs_seen);
+    case tag_static_print: {
+      auto location = this->location();
+      expr = new StaticPrint(location, this->expr());
+      break;
+    }
+    case tag_var:
+      expr = new Var(identifier());
+      break;
+    case tag_match: {
+      auto scrutinee = this->expr();
+      PatternBlocks pattern_blocks;
+      size_t n = count();
+      for (size_t index = 0; index < n; ++index) {
+        auto predicate = this->predicate();
+        pattern_blocks.push_back(new PatternBlock(predicate, this->expr()));
+      }
+      expr = new Match(scrutinee, pattern_blocks, b());
+      break;
+    }
+    case tag_block:
+      expr = new Block(exprs());
+      break;
+    case tag_as: {
+      auto as_expr = this->expr();
+      auto type = this->type();
+      expr = new As(as_expr, type, b());
+      break;
+    }
+    case tag_sizeof: {
+      auto location = this->location();
+      expr = new Sizeof(location, type());
+      break;
+    }
+    case tag_application: {
+      auto a = this->expr();
+      expr = new Application(a, exprs());
+      break;
+    }
+    case tag_lambda: {
+      auto vars = identifiers();
+      if (vars.size() == 0) {
+        throw corrupt_cache{};
+      }
+      auto body = this->expr();
+      auto param_types = types();
+      expr = new Lambda(vars, param_types, type(), body);
+      break;
+    }
+    case tag_let: {
+      auto var = identifier();
+      auto value = this->expr();
+      expr = new Let(var, value, this->expr());
+      break;
+    }
+    case tag_tuple: {
+      auto location = this->location();
+      expr = new Tuple(location, exprs());
+      break;
+    }
+    case tag_tuple_deref: {
+      auto tuple = this->expr();
+      int index = i();
+      int max = i();
+      expr = new TupleDeref(tuple, index, max);
+      break;
+    }
+    case tag_ffi: {
+      auto id = identifier();
+      expr = new FFI(id, exprs());
+      break;
+    }
+    case tag_builtin: {
+      auto var = new Var(identifier());
+      expr = new Builtin(var, exprs());
+      break;
+    }
+    case tag_literal:
+      expr = new Literal(token());
+      break;
+    case tag_conditional: {
+      auto cond = this->expr();
+      auto truthy = this->expr();
+      expr = new Conditional(cond, truthy, this->expr());
+      break;
+    }
+    case tag_return:
+      expr = new ReturnStatement(this->expr());
+      break;
+    case tag_continue:
+      expr = new Continue(location());
+      break;
+    case tag_break:
+      expr = new Break(location());
+      break;
+    case tag_defer: {
+      auto application = dcast<const Application *>(this->expr());
+      if (application == nullptr) {
+        throw corrupt_cache{};
+      }
+      expr = new Defer(application);
+      break;
+    }
+    case tag_while: {
+      auto condition = this->expr();
+      expr = new While(condition, this->expr());
+      break;
+    }
+    default:
+      throw corrupt_cache{};
+    }
+    exprs_seen.push_back(expr);
+    return expr;
+  }
+
+  std::vector<const Expr *> exprs() {
+    std::vector<const Expr *> exprs;
+    size_t n = count();
+    exprs.reserve(n);
+    for (size_t index = 0; index < n; ++index) {
+      exprs.push_back(expr());
+    }
+    return exprs;
+  }
+
+  const Decl *decl() {
+    auto id = identifier();
+    return new Decl(id, expr());
+  }
+
+  std::vector<const Decl *> decls() {
+    std::vector<const Decl *> decls;
+    size_t n = count();
+    decls.reserve(n);
+    for (size_t index = 0; index < n; ++index) {
+      decls.push_back(decl());
+    }
+    return decls;
+  }
+
+  const Module *module() {
+    std::string name = str();
+    auto imports = identifiers();
+    auto decls = this->decls();
+
+    std::vector<const TypeDecl *> type_decls;
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      auto id = identifier();
+      type_decls.push_back(new TypeDecl(id, identifiers()));
+    }
+
+    std::vector<const TypeClass *> type_classes;
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      auto id = identifier();
+      auto type_var_ids = identifiers();
+      types::ClassPredicates class_predicates;
+      for (size_t m = count(), j = 0; j < m; ++j) {
+        class_predicates.insert(class_predicate());
+      }
+      auto overloads = type_map();
+      type_classes.push_back(new TypeClass(id, type_var_ids, class_predicates,
+                                           overloads, this->decls()));
+    }
+
+    std::vector<const Instance *> instances;
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      auto class_predicate = this->class_predicate();
+      instances.push_back(new Instance(class_predicate, this->decls()));
+    }
+
+    ParsedCtorIdMap ctor_id_map;
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      std::string ctor_name = str();
+      ctor_id_map[ctor_name] = i();
+    }
+
+    ParsedDataCtorsMap data_ctors_map;
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      std::string type_name = str();
+      data_ctors_map[type_name] = type_map();
+    }
+
+    auto type_env = type_map();
+    return new Module(name, imports, decls, type_decls, type_classes,
+                      instances, ctor_id_map, data_ctors_map, type_env);
+  }
+
+  void artifacts(ModuleArtifacts &artifacts) {
+    artifacts.module = module();
+
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      artifacts.dependencies.insert(identifier());
+    }
+
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      auto id = identifier();
+      artifacts.symbol_exports[id] = identifier();
+    }
+
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      auto &symbols = artifacts.symbol_imports[str()];
+      for (size_t m = count(), j = 0; j < m; ++j) {
+        symbols.insert(identifier());
+      }
+    }
+
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      auto lit = LinkInType(u());
+      artifacts.link_ins.insert(LinkIn{lit, token()});
+    }
+
+    for (size_t n = count(), index = 0; index < n; ++index) {
+      artifacts.comments.push_back(token());
+    }
+
+    if (pos != data.size()) {
+      throw corrupt_cache{};
+    }
+  }
+};
+
+/* identifies this build of the compiler, since VERSION does not change when
+ * parsing or lowering does. the path, size and modification time of the
+ * executable change with every rebuild, and are far cheaper to get than a hash
+ * of its contents. empty if the executable cannot be found. */
+const std::string &get_compiler_identity() {
+  static bool checked = false;
+  static std::string identity;
+  if (!checked) {
+    checked = true;
+    char path[4096];
+#ifdef __APPLE__
+    uint32_t size = sizeof(path);
+    if (_NSGetExecutablePath(path, &size) != 0) {
+      return identity;
+    }
+#else
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len == -1) {
+      return identity;
+    }
+    path[len] = '\0';
+#endif
+    struct stat st;
+    if (stat(path, &st) == 0) {
+      identity = string_format("%s:%lld:%lld", path, (long long)st.st_size,
+                               (long long)st.st_mtime);
+    }
+  }
+  return identity;
+}
+
+} // namespace
+
+uint64_t fnv1a(uint64_t hash, const std::string &data) {
+  for (unsigned char ch : data) {
+    hash ^= ch;
+    hash *= 0x100000001b3ULL;
+  }
+  /* fold in a terminator so that adjacent fields cannot run together */
+  hash ^= 0xff;
+  hash *= 0x100000001b3ULL;
+  return hash;
+}
+
+std::string get_cache_dir() {
+  if (getenv("ACE_CACHE_DIR") != nullptr) {
+    return getenv("ACE_CACHE_DIR");
+  } else if (getenv("XDG_CACHE_HOME") != nullptr) {
+    return std::string(getenv("XDG_CACHE_HOME")) + "/ace";
+  } else if (getenv("HOME") != nullptr) {
+    return std::string(getenv("HOME")) + "/.cache/ace";
+  } else {
+    return "";
+  }
+}
+
+bool enabled() {
+  static bool checked = false;
+  static bool enabled = true;
+  if (!checked) {
+    checked = true;
+    enabled = (getenv("NO_MODULE_CACHE") == nullptr ||
+               atoi(getenv("NO_MODULE_CACHE")) == 0) &&
+              get_cache_dir().size() != 0;
+  }
+  return enabled;
+}
+
+uint64_t get_key(const std::string &module_filename,
+                 const std::string &source,
+                 uint64_t prelude_key) {
+  uint64_t hash = fnv1a_offset_basis;
+  hash = fnv1a(hash, string_format("%u", format_version));
+  hash = fnv1a(hash, ACE_VERSION);
+  hash = fnv1a(hash, get_compiler_identity());
+  hash = fnv1a(hash, join(get_ace_paths(), ":"));
+  hash = fnv1a(hash, string_format("%llx", (unsigned long long)prelude_key));
+  hash = fnv1a(hash, module_filename);
+  return fnv1a(hash, source);
+}
+
+bool load(uint64_t key, ModuleArtifacts &artifacts) {
+  std::ifstream ifs(get_cache_filename(key), std::ios::binary);
+  if (!ifs.good()) {
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  std::string data = ss.str();
+
+  try {
+    Reader reader(data);
+    reader.header(key);
+    ModuleArtifacts loaded;
+    reader.artifacts(loaded);
+    artifacts = std::move(loaded);
+    return true;
+  } catch (corrupt_cache &) {
+    debug_above(1, log(log_warning, "ignoring corrupt module cache entry %s",
+                       get_cache_filename(key).c_str()));
+    return false;
+  }
+}
+
+void store(uint64_t key, const ModuleArtifacts &artifacts) {
+  std::string cache_dir = get_cache_dir();
+  std::string parent_dir = directory_from_file_path(cache_dir);
+  if ((parent_dir.size() != 0 && !ensure_directory_exists(parent_dir)) ||
+      !ensure_directory_exists(cache_dir)) {
+    debug_above(1, log(log_warning, "unable to create module cache dir %s",
+                       cache_dir.c_str()));
+    return;
+  }
+
+  Writer writer;
+  writer.artifacts(artifacts);
+  std::string data = writer.finish(key);
+
+  /* write to a temporary file and move it into place so that concurrent
+   * builds never see a partially written entry */
+  std::string filename = get_cache_filename(key);
+  std::string temp_filename = string_format("%s.%d.tmp", filename.c_str(),
+                                            (int)getpid());
+  {
+    std::ofstream ofs(temp_filename, std::ios::binary | std::ios::trunc);
+    ofs.write(data.c_str(), data.size());
+    if (!ofs.good()) {
+      unlink(temp_filename.c_str());
+      return;
+    }
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    unlink(temp_filename.c_str());
+  }
+}
+
+} // namespace module_cache
+} // namespace ace
@@ -0,0 +1,52 @@
+#pragma once
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ast_decls.h"
+#include "identifier.h"
+#include "link_ins.h"
+#include "token.h"
+
+namespace ace {
+namespace module_cache {
+
+/* everything that parsing a single module contributes to the
+ * GlobalParserState. on a cache hit this is replayed instead of lexing and
+ * parsing the module again. */
+struct ModuleArtifacts {
+  const ast::Module *module = nullptr;
+  std::set<Identifier> dependencies;
+  std::map<Identifier, Identifier> symbol_exports;
+  std::map<std::string, std::set<Identifier>> symbol_imports;
+  std::set<LinkIn> link_ins;
+  std::vector<Token> comments;
+};
+
+/* the cache is on unless NO_MODULE_CACHE is set to a non-zero value. */
+bool enabled();
+
+/* where cached build artifacts live. empty if there is nowhere to put them. */
+std::string get_cache_dir();
+
+/* folds data into a running FNV-1a hash. start from fnv1a_offset_basis. */
+const uint64_t fnv1a_offset_basis = 0xcbf29ce484222325ULL;
+uint64_t fnv1a(uint64_t hash, const std::string &data);
+
+/* the key covers the source text of the module, the compiler version and
+ * build, the ACE_PATH and the key of the prelude whose exports the module was
+ * parsed against. */
+uint64_t get_key(const std::string &module_filename,
+                 const std::string &source,
+                 uint64_t prelude_key);
+
+/* returns false on a miss, or if the cache entry is stale or corrupt. any
+ * gensym'd names in the cached module are renamed to fresh names so that they
+ * cannot collide with names generated during this run. */
+bool load(uint64_t key, ModuleArtifacts &artifacts);
+void store(uint64_t key, const ModuleArtifacts &artifacts);
+
+} // namespace module_cache
+} // namespace ace
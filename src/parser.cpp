@@ -123,6 +123,273 @@ const Expr *parse_return_statement(ParseState &ps) {
           : unit_expr(INTERNAL_LOC()));
 }
 
+/* map, filter, enumerate and take wrap their input in another iterator
+ * closure. when they appear directly in the iterable of a for loop or a
+ * comprehension, build_for_loop applies them to each item inline instead. */
+enum FusedStageKind {
+  fsk_map,
+  fsk_filter,
+  fsk_enumerate,
+  fsk_take,
+};
+
+struct FusedStage {
+  FusedStageKind kind;
+  /* the function passed to map or filter, or the count passed to take */
+  const Expr *arg;
+  /* arg is bound to this once, before the loop starts */
+  Identifier arg_id;
+  /* the Ref counting items for enumerate and take */
+  Identifier counter_id;
+};
+
+/* peels fusable stages off of iterable, innermost first, and returns the
+ * iterable they all draw from. */
+const Expr *peel_fused_stages(const Expr *iterable,
+                              std::vector<FusedStage> &stages) {
+  while (auto application = dcast<const Application *>(iterable)) {
+    auto var = dcast<const Var *>(application->a);
+    if (var == nullptr) {
+      break;
+    }
+
+    const auto &name = var->id.name;
+    const auto &params = application->params;
+    FusedStage stage;
+    if (name == tld::mktld("std", "map") && params.size() == 2) {
+      stage.kind = fsk_map;
+    } else if (name == tld::mktld("std", "filter") && params.size() == 2) {
+      stage.kind = fsk_filter;
+    } else if (name == tld::mktld("std", "enumerate") && params.size() == 1) {
+      stage.kind = fsk_enumerate;
+    } else if (name == tld::mktld("itertools", "take") && params.size() == 2) {
+      stage.kind = fsk_take;
+    } else {
+      break;
+    }
+
+    auto location = var->get_location();
+    stage.arg = params.size() == 2 ? params[1] : nullptr;
+    stage.arg_id = Identifier{fresh(), location};
+    stage.counter_id = Identifier{fresh(), location};
+    stages.insert(stages.begin(), stage);
+    iterable = params[0];
+  }
+  return iterable;
+}
+
+const Expr *std_call(Location location,
+                     std::string name,
+                     std::vector<const Expr *> params) {
+  return new Application(new Var(Identifier{tld::mktld("std", name), location}),
+                         params);
+}
+
+const Expr *load_ref(const Identifier &ref_id) {
+  return std_call(ref_id.location, "load_value", {new Var(ref_id)});
+}
+
+const Expr *increment_ref(const Identifier &ref_id) {
+  return std_call(
+      ref_id.location, "store_value",
+      {new Var(ref_id),
+       std_call(ref_id.location, "+",
+                {load_ref(ref_id), new Literal(Token{ref_id.location,
+                                                     tk_integer, "1"})})});
+}
+
+const Expr *break_if(const Expr *condition, Location location) {
+  return new Conditional(condition, new Break(location), unit_expr(location));
+}
+
+/* applies stages[index:] to the item in item_id, then hands the result to
+ * pattern_blocks. */
+const Expr *build_fused_stages(const std::vector<FusedStage> &stages,
+                               size_t index,
+                               const Identifier &item_id,
+                               const PatternBlocks &pattern_blocks) {
+  if (index == stages.size()) {
+    return new Match(new Var(item_id), pattern_blocks,
+                     false /*disable_coverage_check*/);
+  }
+
+  const FusedStage &stage = stages[index];
+  auto location = item_id.location;
+  Identifier next_id{fresh(), location};
+  auto rest = build_fused_stages(stages, index + 1,
+                                 stage.kind == fsk_filter ||
+                                         stage.kind == fsk_take
+                                     ? item_id
+                                     : next_id,
+                                 pattern_blocks);
+  switch (stage.kind) {
+  case fsk_map:
+    return new Let(next_id,
+                   new Application(new Var(stage.arg_id), {new Var(item_id)}),
+                   rest);
+  case fsk_filter:
+    return new Block(
+        {new Conditional(std_call(location, "not",
+                                  {new Application(new Var(stage.arg_id),
+                                                   {new Var(item_id)})}),
+                         new Continue(location), unit_expr(location)),
+         rest});
+  case fsk_enumerate:
+    return new Let(
+        next_id,
+        new Tuple(location, {load_ref(stage.counter_id), new Var(item_id)}),
+        new Block({increment_ref(stage.counter_id), rest}));
+  case fsk_take:
+    return new Block({increment_ref(stage.counter_id), rest});
+  }
+  assert(false);
+  return nullptr;
+}
+
+//
+// for predicate in stage_n(...stage_1(iterable)...) { block }
+//
+// expands to:
+// {
+//   let c = iterable
+//   let indexed = is_indexed(c)
+//   let it = indexed ? nothing : iter(c)
+//   var i = 0
+//   ...bind the arguments and counters of each stage...
+//   while True {
+//     ...break if any take has reached its count...
+//     let next = indexed ? Nothing : it()
+//     if indexed ? not has_item_at(c, i) : next is Nothing {
+//       break
+//     }
+//     let item = match next {
+//       Just(x) => x
+//       Nothing => item_at(c, i)
+//     }
+//     i += 1
+//     ...apply stage_1 through stage_n to item...
+//     match item {
+//       predicate => block
+//     }
+//   }
+// }
+//
+// indexed collections (Vector, String and Range) never create the iterator
+// closure or a Just, and nothing but the source is ever iterated.
+//
+const Expr *build_for_loop(Location location,
+                           const Expr *iterable,
+                           const PatternBlocks &pattern_blocks) {
+  std::vector<FusedStage> stages;
+  iterable = peel_fused_stages(iterable, stages);
+
+  Identifier collection_id{fresh(), location};
+  Identifier indexed_id{fresh(), location};
+  Identifier iterator_id{fresh(), location};
+  Identifier index_id{fresh(), location};
+  Identifier next_id{fresh(), location};
+  Identifier item_id{fresh(), location};
+  auto zero = [location]() {
+    return new Literal(Token{location, tk_integer, "0"});
+  };
+
+  std::vector<const Expr *> loop_statements;
+  for (auto &stage : stages) {
+    if (stage.kind == fsk_take) {
+      loop_statements.push_back(break_if(
+          std_call(location, ">=",
+                   {load_ref(stage.counter_id), new Var(stage.arg_id)}),
+          location));
+    }
+  }
+
+  auto current_item = [&]() {
+    return std_call(location, "item_at",
+                    {new Var(collection_id), load_ref(index_id)});
+  };
+  auto is_nothing = new Match(
+      new Var(next_id),
+      {new PatternBlock(
+           new CtorPredicate(location,
+                             {new IrrefutablePredicate(
+                                 location, maybe<Identifier>())},
+                             Identifier{tld::mktld("maybe", "Just"), location},
+                             maybe<Identifier>()),
+           new Var(Identifier{tld::mktld("std", "False"), location})),
+       new PatternBlock(
+           new CtorPredicate(location, {},
+                             Identifier{tld::mktld("maybe", "Nothing"),
+                                        location},
+                             maybe<Identifier>()),
+           new Var(Identifier{tld::mktld("std", "True"), location}))},
+      false /*disable_coverage_check*/);
+  Identifier just_id{fresh(), location};
+  auto unwrap_next = new Match(
+      new Var(next_id),
+      {new PatternBlock(
+           new CtorPredicate(
+               location, {new IrrefutablePredicate(location, just_id)},
+               Identifier{tld::mktld("maybe", "Just"), location},
+               maybe<Identifier>()),
+           new Var(just_id)),
+       new PatternBlock(
+           new CtorPredicate(location, {},
+                             Identifier{tld::mktld("maybe", "Nothing"),
+                                        location},
+                             maybe<Identifier>()),
+           current_item())},
+      false /*disable_coverage_check*/);
+
+  loop_statements.push_back(new Let(
+      next_id,
+      new Conditional(
+          new Var(indexed_id),
+          new Var(Identifier{tld::mktld("maybe", "Nothing"), location}),
+          new Application(new Var(iterator_id), {unit_expr(location)})),
+      new Block(
+          {break_if(new Conditional(
+                        new Var(indexed_id),
+                        std_call(location, "not",
+                                 {std_call(location, "has_item_at",
+                                           {new Var(collection_id),
+                                            load_ref(index_id)})}),
+                        is_nothing),
+                    location),
+           new Let(item_id, unwrap_next,
+                   new Block({increment_ref(index_id),
+                              build_fused_stages(stages, 0, item_id,
+                                                 pattern_blocks)}))})));
+
+  const Expr *loop = new While(
+      new Var(Identifier{tld::mktld("std", "True"), location}),
+      new Block(loop_statements));
+
+  /* bind the stages' arguments in the order that the nested calls would
+   * have evaluated them */
+  for (auto stage = stages.rbegin(); stage != stages.rend(); ++stage) {
+    if (stage->kind == fsk_enumerate || stage->kind == fsk_take) {
+      loop = new Let(stage->counter_id, std_call(location, "Ref", {zero()}),
+                     loop);
+    }
+    if (stage->arg != nullptr) {
+      loop = new Let(stage->arg_id, stage->arg, loop);
+    }
+  }
+
+  return new Let(
+      collection_id, iterable,
+      new Let(
+          indexed_id, std_call(location, "is_indexed", {new Var(collection_id)}),
+          new Let(iterator_id,
+                  new Conditional(
+                      new Var(indexed_id),
+                      new Var(Identifier{tld::mktld("std", "nothing"),
+                                         location}),
+                      std_call(location, "iter", {new Var(collection_id)})),
+                  new Let(index_id, std_call(location, "Ref", {zero()}),
+                          loop))));
+}
+
 const Expr *parse_for_block(ParseState &ps) {
   chomp_ident(K(for));
 
@@ -142,43 +409,19 @@ const Expr *parse_for_block(ParseState &ps) {
       false /*allow_for_comprehensions*/);
   const Expr *block = parse_block(ps, false /*expression_means_return*/);
 
-  auto iterator_id = Identifier{fresh(), for_var_predicate->get_location()};
   PatternBlocks pattern_blocks;
-  pattern_blocks.push_back(new PatternBlock(
-      new CtorPredicate(iterator_id.location, {for_var_predicate},
-                        ps.id_mapped(Identifier{"Just", iterator_id.location}),
-                        maybe<Identifier>()),
-      block));
+  pattern_blocks.push_back(new PatternBlock(for_var_predicate, block));
 
   if (filtered_matching) {
     /* allow for loops to only handle matching patterns */
     pattern_blocks.push_back(new PatternBlock(
-        new CtorPredicate(
-            iterator_id.location,
-            {new IrrefutablePredicate(
-                iterator_id.location,
-                Identifier{fresh(), iterator_id.location})},
-            ps.id_mapped(Identifier{"Just", iterator_id.location}),
-            maybe<Identifier>()),
+        new IrrefutablePredicate(
+            in_token.location,
+            Identifier{fresh(), for_var_predicate->get_location()}),
         new Continue(in_token.location)));
   }
 
-  pattern_blocks.push_back(new PatternBlock(
-      new CtorPredicate(
-          iterator_id.location, {},
-          ps.id_mapped(Identifier{"Nothing", iterator_id.location}),
-          maybe<Identifier>()),
-      new Break(in_token.location)));
-
-  return new Let(
-      iterator_id,
-      new Application(
-          new Var(ps.id_mapped(Identifier{"iter", in_token.location})),
-          {iterable}),
-      new While(new Var(ps.id_mapped(Identifier{"True", in_token.location})),
-                new Match(new Application(new Var(iterator_id),
-                                          {unit_expr(iterator_id.location)}),
-                          pattern_blocks, false /*disable_coverage_check*/)));
+  return build_for_loop(in_token.location, iterable, pattern_blocks);
 }
 
 const Expr *parse_new_expr(ParseState &ps) {
@@ -736,6 +979,51 @@ const Expr *parse_generator(ParseState &ps, const Expr *expr) {
   return build_generator(expr->get_location(), expr, generator_for);
 }
 
+// [expr for predicate in iterable if cond]
+// expands to:
+// {
+//   let v = []
+//   for predicate in iterable {
+//     if cond {
+//       append(v, expr)
+//     }
+//   }
+//   v
+// }
+//
+// so that it shares build_for_loop's fusion instead of filling the vector
+// from a generator closure.
+const Expr *parse_vector_comprehension(ParseState &ps, const Expr *expr) {
+  BoundVarLifetimeTracker bvlt(ps);
+  Location location = expr->get_location();
+  GeneratorFor generator_for = parse_generator_for(ps);
+  if (ps.token.is_ident(K(for))) {
+    throw user_error(ps.token.location,
+                     "nested comprehensions are not legal in Ace");
+  }
+
+  Identifier vector_id{fresh(), location};
+  const Expr *append = new Application(
+      new Var(Identifier{tld::mktld("std", "append"), location}),
+      {new Var(vector_id), expr});
+  if (generator_for.condition != nullptr) {
+    append = new Conditional(generator_for.condition, append,
+                             unit_expr(location));
+  }
+
+  return new Let(
+      vector_id,
+      new As(
+          new Application(new Var(Identifier{
+                              tld::mktld(GLOBAL_SCOPE_NAME, "new"), location}),
+                          {unit_expr(location)}),
+          type_vector_type(type_variable(location)), false /*force_cast*/),
+      new Block({build_for_loop(location, generator_for.iterable,
+                                {new PatternBlock(generator_for.predicate,
+                                                  append)}),
+                 new Var(vector_id)}));
+}
+
 const Expr *parse_array_literal(ParseState &ps) {
   Location location = ps.token.location;
   chomp_token(tk_lsquare);
@@ -796,9 +1084,8 @@ const Expr *parse_array_literal(ParseState &ps) {
       ps.advance();
     } else if (ps.token.is_ident(K(for))) {
       if (i == 1) {
-        const Expr *list_comprehension = new Application(
-            new Var(Identifier{tld::mktld("std", "vector"), location}),
-            {parse_generator(ps, exprs[0])});
+        const Expr *list_comprehension = parse_vector_comprehension(ps,
+                                                                    exprs[0]);
         chomp_token(tk_rsquare);
         return list_comprehension;
 
@@ -928,14 +1215,27 @@ const Expr *parse_string_expr(ParseState &ps) {
     /* don't bother joining if it's just a single expr in a string */
     return exprs[0];
   } else {
-    /* for now, just call join on all of these exprs, after ensuring that they
-     * are stringified. */
-    const Expr *str_array = build_array_literal(location, exprs);
-    return new Application(
-        new Var(ps.id_mapped(Identifier{"join", location})),
-        {parse_string_literal(Token{location, tk_string, "\"\""},
-                              nullptr /*typing*/),
-         str_array});
+    /* append each (stringified) piece to a StringBuilder, which hands its
+     * buffer over to the resulting String without another copy */
+    Identifier builder_id{fresh(), location};
+    std::vector<const Expr *> stmts;
+    for (auto expr : exprs) {
+      stmts.push_back(new Application(
+          new Var(Identifier{tld::mktld("string", "append_string"),
+                             expr->get_location()}),
+          {new Var(builder_id), expr}));
+    }
+    stmts.push_back(new Application(
+        new Var(Identifier{tld::mktld("string", "build_string"), location}),
+        {new Var(builder_id)}));
+    return new Let(
+        builder_id,
+        new Application(
+            new Var(Identifier{tld::mktld("string", "string_builder"),
+                               location}),
+            {new Literal(Token{location, tk_integer,
+                               std::to_string(16 * exprs.size())})}),
+        new Block(stmts));
   }
 }
 
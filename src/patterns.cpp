@@ -1,6 +1,7 @@
 #include "patterns.h"
 
 #include <iostream>
+#include <map>
 
 #include "ast.h"
 #include "builtins.h"
@@ -15,6 +16,281 @@ namespace ace {
 
 using namespace ast;
 
+/* a run of adjacent pattern blocks that all test the same kind of key can be
+ * dispatched with a single Switch instead of testing each block in turn. */
+enum SwitchKind {
+  sk_none = 0,
+  /* the ctor_id in the first word of a boxed data value */
+  sk_ctor_id,
+  /* enums are just Ints */
+  sk_enum,
+  sk_int,
+  sk_char,
+  /* string literals are dispatched on their length, then compared */
+  sk_string,
+};
+
+/* the smallest number of distinct keys that is worth a Switch */
+#define MIN_SWITCH_KEYS 2
+
+static SwitchKind get_switch_kind(const Predicate *predicate,
+                                  const DataCtorsMap &data_ctors_map,
+                                  const TrackedTypes &tracked_types,
+                                  const types::Ref &scrutinee_type,
+                                  const types::Ref &resolved_scrutinee_type,
+                                  int64_t &key) {
+  if (auto ctor_predicate = dcast<const CtorPredicate *>(predicate)) {
+    const Identifier &ctor_name = ctor_predicate->ctor_name;
+    if (type_equality(resolved_scrutinee_type, scrutinee_type)) {
+      key = get_ctor_id(ctor_name.location, data_ctors_map, ctor_name.name);
+      return sk_ctor_id;
+    } else if (ctor_predicate->params.size() == 0) {
+      key = get_ctor_id(ctor_name.location, data_ctors_map, ctor_name.name);
+      return sk_enum;
+    } else {
+      /* newtypes only have the one ctor */
+      return sk_none;
+    }
+  } else if (auto literal = dcast<const Literal *>(predicate)) {
+    const Token &token = literal->token;
+    switch (token.tk) {
+    case tk_integer:
+      if (types::is_type_id(get_tracked_type(tracked_types, literal),
+                            INT_TYPE)) {
+        key = parse_int_value(token);
+        return sk_int;
+      }
+      return sk_none;
+    case tk_char:
+      assert(token.text.size() == 1);
+      key = token.text[0];
+      return sk_char;
+    case tk_string: {
+      auto tuple_type = dyncast<const types::TypeTuple>(
+          resolved_scrutinee_type);
+      if (tuple_type != nullptr && tuple_type->dimensions.size() == 2) {
+        key = unescape_json_quotes(token.text).size();
+        return sk_string;
+      }
+      return sk_none;
+    }
+    default:
+      return sk_none;
+    }
+  } else {
+    return sk_none;
+  }
+}
+
+const Expr *build_patterns(const types::DefnId &for_defn_id,
+                           const PatternBlocks &pattern_blocks,
+                           int index,
+                           const DataCtorsMap &data_ctors_map,
+                           const std::unordered_set<std::string> &bound_vars_,
+                           const TrackedTypes &tracked_types,
+                           const types::TypeEnv &type_env,
+                           TrackedTypes &typing,
+                           types::NeededDefns &needed_defns,
+                           bool &returns,
+                           Identifier scrutinee_id,
+                           types::Ref scrutinee_type,
+                           types::Ref expected_type);
+
+/* translates the blocks in arms (which all share the key that the Switch has
+ * already dispatched on) in order, falling back to the blocks after the run
+ * when none of them match. */
+static const Expr *build_switch_case(
+    const types::DefnId &for_defn_id,
+    const PatternBlocks &pattern_blocks,
+    SwitchKind switch_kind,
+    const std::vector<int> &arms,
+    int arm_index,
+    int run_end,
+    const DataCtorsMap &data_ctors_map,
+    const std::unordered_set<std::string> &bound_vars_,
+    const TrackedTypes &tracked_types,
+    const types::TypeEnv &type_env,
+    TrackedTypes &typing,
+    types::NeededDefns &needed_defns,
+    bool &returns,
+    Identifier scrutinee_id,
+    types::Ref scrutinee_type,
+    types::Ref expected_type) {
+  auto &pattern_block = pattern_blocks[arms[arm_index]];
+  auto scrutinee_id_with_name_assignment =
+      pattern_block->predicate->instantiate_name_assignment();
+
+  auto bound_vars = bound_vars_;
+  bound_vars.insert(scrutinee_id_with_name_assignment.name);
+
+  /* same as in build_patterns, coverage analysis tells us that the very last
+   * candidate must match. */
+  bool do_checks = (arm_index + 1 != int(arms.size()) ||
+                    run_end != int(pattern_blocks.size()));
+
+  auto matched = [&for_defn_id, &pattern_block](
+                     const DataCtorsMap &data_ctors_map,
+                     const std::unordered_set<std::string> &bound_vars,
+                     const TrackedTypes &tracked_types,
+                     const types::TypeEnv &type_env, TrackedTypes &typing,
+                     types::NeededDefns &needed_defns,
+                     bool &returns) -> const Expr * {
+    return texpr(for_defn_id, pattern_block->result, data_ctors_map,
+                 bound_vars, tracked_types,
+                 get_tracked_type(tracked_types, pattern_block->result),
+                 type_env, typing, needed_defns, returns);
+  };
+  auto failed = [&for_defn_id, &pattern_blocks, switch_kind, &arms, arm_index,
+                 run_end, &scrutinee_id, &scrutinee_type, &expected_type](
+                    const DataCtorsMap &data_ctors_map,
+                    const std::unordered_set<std::string> &bound_vars,
+                    const TrackedTypes &tracked_types,
+                    const types::TypeEnv &type_env, TrackedTypes &typing,
+                    types::NeededDefns &needed_defns,
+                    bool &returns) -> const Expr * {
+    if (arm_index + 1 < int(arms.size())) {
+      return build_switch_case(for_defn_id, pattern_blocks, switch_kind, arms,
+                               arm_index + 1, run_end, data_ctors_map,
+                               bound_vars, tracked_types, type_env, typing,
+                               needed_defns, returns, scrutinee_id,
+                               scrutinee_type, expected_type);
+    } else if (run_end < int(pattern_blocks.size())) {
+      return build_patterns(for_defn_id, pattern_blocks, run_end,
+                            data_ctors_map, bound_vars, tracked_types, type_env,
+                            typing, needed_defns, returns, scrutinee_id,
+                            scrutinee_type, expected_type);
+    } else {
+      assert(false);
+      return nullptr;
+    }
+  };
+
+  const Expr *body = nullptr;
+  switch (switch_kind) {
+  case sk_ctor_id:
+    body = safe_dcast<const CtorPredicate>(pattern_block->predicate)
+               ->translate_params(for_defn_id,
+                                  scrutinee_id_with_name_assignment,
+                                  scrutinee_type, do_checks, data_ctors_map,
+                                  bound_vars, tracked_types, type_env, typing,
+                                  needed_defns, returns, matched, failed);
+    break;
+  case sk_string:
+    /* the Switch only checked the length */
+    body = pattern_block->predicate->translate(
+        for_defn_id, scrutinee_id_with_name_assignment, scrutinee_type,
+        do_checks, data_ctors_map, bound_vars, tracked_types, type_env, typing,
+        needed_defns, returns, matched, failed);
+    break;
+  case sk_enum:
+  case sk_int:
+  case sk_char:
+    /* the Switch already did the only check there is */
+    body = matched(data_ctors_map, bound_vars, tracked_types, type_env, typing,
+                   needed_defns, returns);
+    break;
+  case sk_none:
+    assert(false);
+    break;
+  }
+
+  auto scrutinee = new Var(scrutinee_id);
+  typing[scrutinee] = scrutinee_type;
+  auto expr = new Let(scrutinee_id_with_name_assignment, scrutinee, body);
+  typing[expr] = expected_type;
+  return expr;
+}
+
+static const Expr *build_switch(
+    const types::DefnId &for_defn_id,
+    const PatternBlocks &pattern_blocks,
+    SwitchKind switch_kind,
+    const std::map<int64_t, std::vector<int>> &arms_by_key,
+    int run_end,
+    const DataCtorsMap &data_ctors_map,
+    const std::unordered_set<std::string> &bound_vars,
+    const TrackedTypes &tracked_types,
+    const types::TypeEnv &type_env,
+    TrackedTypes &typing,
+    types::NeededDefns &needed_defns,
+    bool &returns,
+    Identifier scrutinee_id,
+    types::Ref scrutinee_type,
+    types::Ref resolved_scrutinee_type,
+    types::Ref expected_type) {
+  static auto Int = type_int(INTERNAL_LOC());
+
+  auto scrutinee = new Var(scrutinee_id);
+  typing[scrutinee] = scrutinee_type;
+
+  const Expr *key = nullptr;
+  switch (switch_kind) {
+  case sk_ctor_id: {
+    Var *get_ctor_id = new Var(make_iid("__builtin_get_ctor_id"));
+    typing[get_ctor_id] = type_arrow(type_params({scrutinee_type}), Int);
+    key = new Builtin(get_ctor_id, {scrutinee});
+    typing[key] = Int;
+    break;
+  }
+  case sk_enum:
+    key = new As(scrutinee, resolved_scrutinee_type, true /*force_cast*/);
+    typing[key] = resolved_scrutinee_type;
+    break;
+  case sk_int:
+  case sk_char:
+    key = scrutinee;
+    break;
+  case sk_string: {
+    /* String is a newtype of (*Char, Int) */
+    auto tuple_type = safe_dyncast<const types::TypeTuple>(
+        resolved_scrutinee_type);
+    auto scrutinee_as_tuple = new As(scrutinee, resolved_scrutinee_type,
+                                     true /*force_cast*/);
+    typing[scrutinee_as_tuple] = resolved_scrutinee_type;
+    key = new TupleDeref(scrutinee_as_tuple, 1, 0 /*ignored in gen phase*/);
+    typing[key] = tuple_type->dimensions[1];
+    break;
+  }
+  case sk_none:
+    assert(false);
+    break;
+  }
+
+  bool all_return = true;
+  Switch::Cases cases;
+  for (auto &pair : arms_by_key) {
+    bool case_returns = false;
+    cases.push_back(
+        {pair.first,
+         build_switch_case(for_defn_id, pattern_blocks, switch_kind,
+                           pair.second, 0, run_end, data_ctors_map, bound_vars,
+                           tracked_types, type_env, typing, needed_defns,
+                           case_returns, scrutinee_id, scrutinee_type,
+                           expected_type)});
+    all_return = all_return && case_returns;
+  }
+
+  const Expr *default_case = nullptr;
+  if (run_end < int(pattern_blocks.size())) {
+    bool default_returns = false;
+    default_case = build_patterns(for_defn_id, pattern_blocks, run_end,
+                                  data_ctors_map, bound_vars, tracked_types,
+                                  type_env, typing, needed_defns,
+                                  default_returns, scrutinee_id,
+                                  scrutinee_type, expected_type);
+    all_return = all_return && default_returns;
+  }
+
+  debug_above(4, log("dispatching %d pattern blocks with a switch on %s",
+                     int(arms_by_key.size()), key->str().c_str()));
+
+  auto switch_ = new Switch(key, cases, default_case);
+  typing[switch_] = expected_type;
+  assert(!returns);
+  returns = returns || all_return;
+  return switch_;
+}
+
 const Expr *build_patterns(const types::DefnId &for_defn_id,
                            const PatternBlocks &pattern_blocks,
                            int index,
@@ -33,6 +309,35 @@ const Expr *build_patterns(const types::DefnId &for_defn_id,
     typing[last_block] = type_unit(INTERNAL_LOC());
     return last_block;
   } else {
+    /* find the run of pattern blocks starting here that can all be dispatched
+     * on the same kind of key, and group them by key, keeping the order of
+     * blocks that share a key. */
+    types::Ref resolved_scrutinee_type = scrutinee_type->eval(
+        type_env, true /*shallow*/);
+    std::map<int64_t, std::vector<int>> arms_by_key;
+    int64_t key = 0;
+    SwitchKind switch_kind = get_switch_kind(
+        pattern_blocks[index]->predicate, data_ctors_map, tracked_types,
+        scrutinee_type, resolved_scrutinee_type, key);
+    int run_end = index;
+    if (switch_kind != sk_none) {
+      while (run_end < int(pattern_blocks.size()) &&
+             get_switch_kind(pattern_blocks[run_end]->predicate,
+                             data_ctors_map, tracked_types, scrutinee_type,
+                             resolved_scrutinee_type, key) == switch_kind) {
+        arms_by_key[key].push_back(run_end);
+        ++run_end;
+      }
+    }
+
+    if (arms_by_key.size() >= MIN_SWITCH_KEYS) {
+      return build_switch(for_defn_id, pattern_blocks, switch_kind,
+                          arms_by_key, run_end, data_ctors_map, bound_vars_,
+                          tracked_types, type_env, typing, needed_defns,
+                          returns, scrutinee_id, scrutinee_type,
+                          resolved_scrutinee_type, expected_type);
+    }
+
     auto &pattern_block = pattern_blocks[index];
 
     /* if pattern-matches then let names = {names} in block else build next
@@ -441,16 +746,10 @@ const Expr *CtorPredicate::translate(
 
     bool truthy_returns = false;
     bool falsey_returns = false;
-    auto match_body = (params.size() != 0)
-                          ? translate_next(
-                                for_defn_id, scrutinee_id, scrutinee_type,
-                                ctor_terms, do_checks, data_ctors_map,
-                                bound_vars, tracked_types, params, 0,
-                                1 /*dim_offset*/, type_env, typing,
-                                needed_defns, truthy_returns, matched, failed)
-                          : matched(data_ctors_map, bound_vars, tracked_types,
-                                    type_env, typing, needed_defns,
-                                    truthy_returns);
+    auto match_body = translate_params(
+        for_defn_id, scrutinee_id, scrutinee_type, do_checks, data_ctors_map,
+        bound_vars, tracked_types, type_env, typing, needed_defns,
+        truthy_returns, matched, failed);
     auto cond = new Conditional(condition, match_body,
                                 failed(data_ctors_map, bound_vars,
                                        tracked_types, type_env, typing,
@@ -461,15 +760,42 @@ const Expr *CtorPredicate::translate(
     returns = returns || (truthy_returns && falsey_returns);
     return cond;
   } else {
-    return (params.size() != 0)
-               ? translate_next(for_defn_id, scrutinee_id, scrutinee_type,
-                                ctor_terms, do_checks, data_ctors_map,
-                                bound_vars, tracked_types, params, 0,
-                                1 /*dim_offset*/, type_env, typing,
-                                needed_defns, returns, matched, failed)
-               : matched(data_ctors_map, bound_vars, tracked_types, type_env,
-                         typing, needed_defns, returns);
+    return translate_params(for_defn_id, scrutinee_id, scrutinee_type,
+                            do_checks, data_ctors_map, bound_vars,
+                            tracked_types, type_env, typing, needed_defns,
+                            returns, matched, failed);
+  }
+}
+
+const Expr *CtorPredicate::translate_params(
+    const types::DefnId &for_defn_id,
+    const Identifier &scrutinee_id,
+    const types::Ref &scrutinee_type,
+    bool do_checks,
+    const DataCtorsMap &data_ctors_map,
+    const std::unordered_set<std::string> &bound_vars,
+    const TrackedTypes &tracked_types,
+    const types::TypeEnv &type_env,
+    TrackedTypes &typing,
+    types::NeededDefns &needed_defns,
+    bool &returns,
+    TranslateContinuationFn &matched,
+    TranslateContinuationFn &failed) const {
+  if (params.size() == 0) {
+    return matched(data_ctors_map, bound_vars, tracked_types, type_env, typing,
+                   needed_defns, returns);
   }
+
+  types::Refs ctor_terms = unfold_arrows(
+      get_data_ctor_type(data_ctors_map, scrutinee_type, ctor_name));
+  assert(ctor_terms.size() >= 1);
+  ctor_terms = vec_slice(ctor_terms, 0, ctor_terms.size() - 1);
+
+  /* skip over the ctor_id */
+  return translate_next(for_defn_id, scrutinee_id, scrutinee_type, ctor_terms,
+                        do_checks, data_ctors_map, bound_vars, tracked_types,
+                        params, 0, 1 /*dim_offset*/, type_env, typing,
+                        needed_defns, returns, matched, failed);
 }
 
 void TuplePredicate::get_bound_vars(
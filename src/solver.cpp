@@ -67,33 +67,27 @@ types::Map solver(bool check_constraint_coverage,
   }
 #endif
 
-  types::Map bindings;
+  /* unify everything against a single union-find store. nothing is rebound
+   * until all constraints have been seen. */
+  types::TypeVarStore store;
   std::list<std::pair<Context, types::Unification>> errors;
 
-  for (auto iter = constraints.begin(); iter != constraints.end();) {
-    types::Unification unification = types::unify(iter->a, iter->b);
-    if (unification.result) {
-      if (unification.bindings.size() != 0) {
-        rebind_tracked_types(tracked_types, unification.bindings);
-        scheme_resolver.rebind(unification.bindings);
-
-        /* save the bindings */
-        types::Map new_bindings = compose(unification.bindings, bindings);
-        std::swap(bindings, new_bindings);
-      }
-      ++iter;
+  for (auto &constraint : constraints) {
+    types::Unification unification = store.unify(constraint.a, constraint.b);
+    if (!unification.result) {
+      errors.push_back({constraint.context, unification});
+    }
+  }
 
-      rebind_constraints(iter, constraints.end(), unification.bindings);
+  types::Map bindings = store.get_bindings();
+  if (bindings.size() != 0) {
+    rebind_tracked_types(tracked_types, bindings);
+    scheme_resolver.rebind(bindings);
 
-      /* rebind the class predicates */
-      instance_requirements = types::rebind(instance_requirements,
-                                            unification.bindings);
-      continue;
-    } else {
-      errors.push_back({iter->context, unification});
-      ++iter;
-    }
+    /* rebind the class predicates */
+    instance_requirements = types::rebind(instance_requirements, bindings);
   }
+
   if (errors.size() != 0) {
     auto iter = errors.begin();
     auto _error = user_error(iter->first.location, "while checking that %s",
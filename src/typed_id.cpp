@@ -15,5 +15,8 @@ std::ostream &operator<<(std::ostream &os, const TypedId &typed_id) {
 }
 
 bool TypedId::operator<(const TypedId &rhs) const {
-  return repr() < rhs.repr();
+  if (id.name != rhs.id.name) {
+    return id.name < rhs.id.name;
+  }
+  return types::compare(type.get(), rhs.type.get()) < 0;
 }
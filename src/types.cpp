@@ -81,6 +81,91 @@ std::string Type::repr(const Map &bindings) const {
   return ss.str();
 }
 
+bool InternKey::operator==(const InternKey &rhs) const {
+  return hash == rhs.hash && kind == rhs.kind && name == rhs.name &&
+         children == rhs.children;
+}
+
+namespace {
+
+struct InternKeyHasher {
+  size_t operator()(const InternKey &key) const {
+    return key.hash;
+  }
+};
+
+typedef std::unordered_map<InternKey, Ref, InternKeyHasher> InternTable;
+
+InternTable &get_intern_table() {
+  /* representatives live for the duration of the compilation */
+  static InternTable intern_table;
+  return intern_table;
+}
+
+} // namespace
+
+const Type *Type::interned() const {
+  if (interned_ == nullptr) {
+    InternKey key;
+    get_intern_key(key);
+
+    /* the hash is purely structural (no pointers) so that orderings derived
+     * from it are stable across runs. */
+    key.hash = hash_combine(std::hash<std::string>()(key.name), key.kind);
+    for (auto child : key.children) {
+      key.hash = hash_combine(key.hash, child->hash());
+    }
+
+    auto &intern_table = get_intern_table();
+    auto iter = intern_table.find(key);
+    if (iter == intern_table.end()) {
+      iter = intern_table.insert({key, shared_from_this()}).first;
+    }
+    interned_ = iter->second.get();
+    hash_ = key.hash;
+  }
+  return interned_;
+}
+
+size_t Type::hash() const {
+  interned();
+  return hash_;
+}
+
+int compare(const Type *a, const Type *b) {
+  if (a == b) {
+    return 0;
+  }
+
+  a = a->interned();
+  b = b->interned();
+  if (a == b) {
+    return 0;
+  } else if (a->hash() != b->hash()) {
+    return a->hash() < b->hash() ? -1 : 1;
+  }
+
+  /* distinct structures with colliding hashes. fall back to walking them. */
+  InternKey key_a, key_b;
+  a->get_intern_key(key_a);
+  b->get_intern_key(key_b);
+  if (key_a.kind != key_b.kind) {
+    return key_a.kind < key_b.kind ? -1 : 1;
+  } else if (int cmp = key_a.name.compare(key_b.name)) {
+    return cmp;
+  } else if (key_a.children.size() != key_b.children.size()) {
+    return key_a.children.size() < key_b.children.size() ? -1 : 1;
+  }
+
+  for (size_t i = 0; i < key_a.children.size(); ++i) {
+    if (int cmp = compare(key_a.children[i], key_b.children[i])) {
+      return cmp;
+    }
+  }
+  assert(false);
+  return 0;
+}
+
 types::ClassPredicates get_overlapping_predicates(
     const types::ClassPredicates &class_predicates,
     const Ftvs &ftvs,
@@ -211,6 +296,11 @@ Location TypeId::get_location() const {
   return id.location;
 }
 
+void TypeId::get_intern_key(InternKey &key) const {
+  key.kind = 'I';
+  key.name = id.name;
+}
+
 TypeVariable::TypeVariable(Identifier id) : id(id) {
 #ifdef ACE_DEBUG
   for (auto ch : id.name) {
@@ -278,6 +368,11 @@ Location TypeVariable::get_location() const {
   return id.location;
 }
 
+void TypeVariable::get_intern_key(InternKey &key) const {
+  key.kind = 'V';
+  key.name = id.name;
+}
+
 TypeOperator::TypeOperator(Ref oper, Ref operand)
     : oper(oper), operand(operand) {
 }
@@ -367,6 +462,11 @@ Location TypeOperator::get_location() const {
   return oper->get_location();
 }
 
+void TypeOperator::get_intern_key(InternKey &key) const {
+  key.kind = 'O';
+  key.children = {oper->interned(), operand->interned()};
+}
+
 TypeTuple::TypeTuple(Location location, const Refs &dimensions)
     : location(location), dimensions(dimensions) {
 #ifdef ACE_DEBUG
@@ -487,6 +587,13 @@ Location TypeTuple::get_location() const {
   return location;
 }
 
+void TypeTuple::get_intern_key(InternKey &key) const {
+  key.kind = 'T';
+  for (auto &dimension : dimensions) {
+    key.children.push_back(dimension->interned());
+  }
+}
+
 TypeParams::TypeParams(Location location, const Refs &dimensions)
     : location(location), dimensions(dimensions) {
 #ifdef ACE_DEBUG
@@ -605,6 +712,13 @@ Location TypeParams::get_location() const {
   return location;
 }
 
+void TypeParams::get_intern_key(InternKey &key) const {
+  key.kind = 'P';
+  for (auto &dimension : dimensions) {
+    key.children.push_back(dimension->interned());
+  }
+}
+
 TypeLambda::TypeLambda(Identifier binding, Ref body)
     : binding(binding), body(body) {
   assert(islower(binding.name[0]));
@@ -693,6 +807,12 @@ Location TypeLambda::get_location() const {
   return binding.location;
 }
 
+void TypeLambda::get_intern_key(InternKey &key) const {
+  key.kind = 'L';
+  key.name = binding.name;
+  key.children = {body->interned()};
+}
+
 bool is_unit(Ref type) {
   if (auto tuple = dyncast<const types::TypeTuple>(type)) {
     return tuple->dimensions.size() == 0;
@@ -31,6 +31,17 @@ typedef std::pair<Ref, Ref> Pair;
 
 namespace types {
 
+/* the structural identity of a single type node, ignoring locations. children
+ * are always interned representatives, so comparing keys is shallow. */
+struct InternKey {
+  char kind;
+  std::string name;
+  std::vector<const Type *> children;
+  size_t hash = 0;
+
+  bool operator==(const InternKey &rhs) const;
+};
+
 struct Type : public std::enable_shared_from_this<Type> {
   virtual ~Type() {
   }
@@ -73,16 +84,40 @@ struct Type : public std::enable_shared_from_this<Type> {
     return 10;
   }
 
+  /* types are hash-consed into a global table of representatives. two types
+   * are structurally equal (modulo locations) iff they share a
+   * representative. */
+  const Type *interned() const;
+  size_t hash() const;
+  virtual void get_intern_key(InternKey &key) const = 0;
+
 private:
   mutable bool ftvs_valid_ = false;
+  mutable const Type *interned_ = nullptr;
+  mutable size_t hash_ = 0;
 
 protected:
   mutable Ftvs ftvs_;
 };
 
+/* a deterministic total order over the structure of types. */
+int compare(const Type *a, const Type *b);
+
 struct CompareType {
   bool operator()(const Ref &a, const Ref &b) const {
-    return a->repr() < b->repr();
+    return compare(a.get(), b.get()) < 0;
+  }
+};
+
+struct HashType {
+  size_t operator()(const Ref &type) const {
+    return type->hash();
+  }
+};
+
+struct EqualType {
+  bool operator()(const Ref &a, const Ref &b) const {
+    return a == b || a->interned() == b->interned();
   }
 };
 
@@ -105,6 +140,8 @@ struct TypeVariable final : public Type {
                  const std::string &pre) const override;
   Location get_location() const override;
   Ref with_location(Location location) const override;
+
+  void get_intern_key(InternKey &key) const override;
 };
 
 struct TypeId final : public Type {
@@ -124,6 +161,8 @@ struct TypeId final : public Type {
                  const std::string &pre) const override;
   Location get_location() const override;
   Ref with_location(Location location) const override;
+
+  void get_intern_key(InternKey &key) const override;
 };
 
 struct TypeOperator final : public Type {
@@ -148,6 +187,8 @@ struct TypeOperator final : public Type {
                  const std::string &pre) const override;
   Location get_location() const override;
   Ref with_location(Location location) const override;
+
+  void get_intern_key(InternKey &key) const override;
 };
 
 struct TypeTuple final : public Type {
@@ -172,6 +213,8 @@ struct TypeTuple final : public Type {
 
   Location location;
   Refs dimensions;
+
+  void get_intern_key(InternKey &key) const override;
 };
 
 struct TypeParams final : public Type {
@@ -196,6 +239,8 @@ struct TypeParams final : public Type {
 
   Location location;
   Refs dimensions;
+
+  void get_intern_key(InternKey &key) const override;
 };
 
 struct TypeLambda final : public Type {
@@ -220,6 +265,8 @@ struct TypeLambda final : public Type {
   Ref apply(types::Ref type) const override;
   Location get_location() const override;
   Ref with_location(Location location) const override;
+
+  void get_intern_key(InternKey &key) const override;
 };
 
 Ref unitize(Ref type);
@@ -22,7 +22,7 @@ types::SchemeRef scheme_unify(types::Scheme::Ref a, types::Scheme::Ref b) {
   // log("checking %s == %s", a->str().c_str(), b->str().c_str());
   // log("normalized checking %s == %s", a->normalize()->str().c_str(),
   // b->normalize()->str().c_str());
-  if (a->normalize()->str() == b->normalize()->str()) {
+  if (scheme_identical(a->normalize(), b->normalize())) {
     debug_above(4, log("found exact match between %s and %s", a->str().c_str(),
                        b->str().c_str()));
     return a;
@@ -42,8 +42,9 @@ types::SchemeRef scheme_unify(types::Scheme::Ref a, types::Scheme::Ref b) {
   }
 
   auto scheme = ta->rebind(unification.bindings)->generalize({});
-  assert(scheme->normalize()->repr() ==
-         tb->rebind(unification.bindings)->generalize({})->normalize()->repr());
+  assert(scheme_identical(
+      scheme->normalize(),
+      tb->rebind(unification.bindings)->generalize({})->normalize()));
   return scheme;
 }
 
@@ -55,7 +56,7 @@ bool scheme_equality(types::Scheme::Ref a, types::Scheme::Ref b) {
   // log("checking %s == %s", a->str().c_str(), b->str().c_str());
   // log("normalized checking %s == %s", a->normalize()->str().c_str(),
   // b->normalize()->str().c_str());
-  if (a->normalize()->str() == b->normalize()->str()) {
+  if (scheme_identical(a->normalize(), b->normalize())) {
     return true;
   }
 
@@ -72,209 +73,245 @@ bool scheme_equality(types::Scheme::Ref a, types::Scheme::Ref b) {
 }
 
 bool type_equality(types::Ref a, types::Ref b) {
-  if (a == b) {
-    /* the same pointer */
-    return true;
+  /* interned types share a representative iff they are structurally equal */
+  return a == b || a->interned() == b->interned();
+}
+
+bool scheme_identical(types::Scheme::Ref a, types::Scheme::Ref b) {
+  /* compare normalized schemes structurally, without unification */
+  return a->vars == b->vars && type_equality(a->type, b->type) &&
+         a->predicates == b->predicates;
+}
+
+TypeVarStore::TypeVarStore() {
+}
+
+Ref TypeVarStore::find(Ref type) {
+  auto tv = dyncast<const TypeVariable>(type);
+  if (tv == nullptr) {
+    return type;
   }
 
-  if (auto ti_a = dyncast<const TypeId>(a)) {
-    if (auto ti_b = dyncast<const TypeId>(b)) {
-      return ti_a->id.name == ti_b->id.name;
-    } else {
-      return false;
-    }
-  } else if (auto tv_a = dyncast<const TypeVariable>(a)) {
-    if (auto tv_b = dyncast<const TypeVariable>(b)) {
-      return tv_a->id.name == tv_b->id.name;
-    } else {
-      return false;
-    }
-  } else if (auto to_a = dyncast<const TypeOperator>(a)) {
-    if (auto to_b = dyncast<const TypeOperator>(b)) {
-      return (type_equality(to_a->oper, to_b->oper) &&
-              type_equality(to_a->operand, to_b->operand));
-    } else {
-      return false;
-    }
-  } else if (auto tpa_a = dyncast<const TypeParams>(a)) {
-    if (auto tpa_b = dyncast<const TypeParams>(b)) {
-      if (tpa_a->dimensions.size() != tpa_b->dimensions.size()) {
-        return false;
-      }
-      for (size_t i = 0; i < tpa_a->dimensions.size(); ++i) {
-        if (!type_equality(tpa_a->dimensions[i], tpa_b->dimensions[i])) {
-          return false;
-        }
-      }
+  auto iter = parents.find(tv->id.name);
+  if (iter == parents.end()) {
+    /* this is an unbound type variable */
+    return type;
+  }
+
+  Ref representative = find(iter->second);
+  if (representative != iter->second) {
+    /* path compression. recorded on the trail so that it can be undone along
+     * with the binding that made it possible. */
+    trail.push_back({tv->id.name, iter->second});
+    iter->second = representative;
+  }
+  return representative;
+}
+
+bool TypeVarStore::occurs(const std::string &name, Ref type) {
+  for (auto &ftv : type->get_ftvs()) {
+    if (ftv == name) {
       return true;
     }
-  } else if (auto tup_a = dyncast<const TypeTuple>(a)) {
-    if (auto tup_b = dyncast<const TypeTuple>(b)) {
-      if (tup_a->dimensions.size() != tup_b->dimensions.size()) {
-        return false;
-      }
-      for (size_t i = 0; i < tup_a->dimensions.size(); ++i) {
-        if (!type_equality(tup_a->dimensions[i], tup_b->dimensions[i])) {
-          return false;
-        }
-      }
+    auto iter = parents.find(ftv);
+    if (iter != parents.end() && occurs(name, iter->second)) {
       return true;
     }
-  } else {
-    auto error = ace::user_error(
-        a->get_location(),
-        "type_equality is not implemented between these two types");
-    error.add_info(b->get_location(), "%s and %s", a->str().c_str(),
-                   b->str().c_str());
-    throw error;
   }
   return false;
 }
 
-inline bool occurs_check(std::string a, Ref type) {
-  return in(a, type->get_ftvs());
-}
-
-Unification bind(std::string a, Ref type) {
-  /* return a Unification which is the result of substitution [type/a] */
-
+Unification TypeVarStore::bind(std::string a, Ref type) {
   /* first do an occurs check */
-  if (type->get_ftvs().count(a) != 0) {
+  if (occurs(a, type)) {
     /* this type exists within its own substitution. Fail. */
     return Unification{false,
                        type->get_location(),
                        string_format("infinite type detected! %s = %s",
-                                     a.c_str(), type->str().c_str()),
+                                     a.c_str(), zonk(type)->str().c_str()),
                        {}};
   }
 
-  return Unification{true, type->get_location(), "", Map{{a, type}}};
+  assert(!in(a, parents));
+  trail.push_back({a, nullptr});
+  parents[a] = type;
+  zonked.clear();
+  return Unification{true, type->get_location(), "", {}};
 }
 
-Unification unify(Ref a, Ref b) {
+void TypeVarStore::rollback(size_t mark) {
+  while (trail.size() > mark) {
+    auto &entry = trail.back();
+    if (entry.second == nullptr) {
+      parents.erase(entry.first);
+    } else {
+      parents[entry.first] = entry.second;
+    }
+    trail.pop_back();
+  }
+  zonked.clear();
+}
+
+Unification TypeVarStore::unify(Ref a, Ref b) {
   assert(a != nullptr);
   assert(b != nullptr);
+  a = find(a);
+  b = find(b);
   debug_above(8, log("unify(%s, %s)", a->str().c_str(), b->str().c_str()));
   if (type_equality(a, b)) {
     return Unification{true, INTERNAL_LOC(), "", {}};
   }
 
+  const size_t mark = trail.size();
+  Unification unification{false, INTERNAL_LOC(), "", {}};
+  bool matched = true;
   if (auto tv_a = dyncast<const TypeVariable>(a)) {
-    return bind(tv_a->id.name, b);
+    unification = bind(tv_a->id.name, b);
   } else if (auto tv_b = dyncast<const TypeVariable>(b)) {
-    return bind(tv_b->id.name, a);
+    unification = bind(tv_b->id.name, a);
   } else if (auto to_a = dyncast<const TypeOperator>(a)) {
     if (auto to_b = dyncast<const TypeOperator>(b)) {
-      return unify_many({to_a->oper, to_a->operand},
-                        {to_b->oper, to_b->operand});
+      unification = unify_many({to_a->oper, to_a->operand},
+                               {to_b->oper, to_b->operand});
+    } else {
+      matched = false;
     }
   } else if (auto tpa_a = dyncast<const TypeParams>(a)) {
     if (auto tpa_b = dyncast<const TypeParams>(b)) {
-      return unify_many(tpa_a->dimensions, tpa_b->dimensions);
+      unification = unify_many(tpa_a->dimensions, tpa_b->dimensions);
+    } else {
+      matched = false;
     }
   } else if (auto tup_a = dyncast<const TypeTuple>(a)) {
     if (auto tup_b = dyncast<const TypeTuple>(b)) {
-      return unify_many(tup_a->dimensions, tup_b->dimensions);
+      unification = unify_many(tup_a->dimensions, tup_b->dimensions);
+    } else {
+      matched = false;
     }
+  } else {
+    matched = false;
   }
 
-  auto location = best_location(a->get_location(), b->get_location());
-  return Unification{
-      false,
-      location,
-      string_format("type error. %s != %s (%s, %s)", a->str().c_str(),
-                    b->str().c_str(), a->get_location().str().c_str(),
-                    b->get_location().str().c_str()),
-      {},
-  };
-}
-
-types::Map compose(const types::Map &a, const types::Map &b) {
-  debug_above(11,
-              log("composing {%s} with {%s}",
-                  join_with(a, ", ",
-                            [](const auto &pair) {
-                              return string_format("%s: %s", pair.first.c_str(),
-                                                   pair.second->str().c_str());
-                            })
-                      .c_str(),
-                  join_with(b, ", ", [](const auto &pair) {
-                    return string_format("%s: %s", pair.first.c_str(),
-                                         pair.second->str().c_str());
-                  }).c_str()));
-  types::Map m;
-  for (auto pair : b) {
-    m[pair.first] = pair.second->rebind(a);
+  if (!matched) {
+    auto za = zonk(a);
+    auto zb = zonk(b);
+    auto location = best_location(za->get_location(), zb->get_location());
+    unification = Unification{
+        false,
+        location,
+        string_format("type error. %s != %s (%s, %s)", za->str().c_str(),
+                      zb->str().c_str(), za->get_location().str().c_str(),
+                      zb->get_location().str().c_str()),
+        {},
+    };
   }
-  for (auto pair : a) {
-    debug_above(11, log("-- check %s in %s when going to assign it to %s -- ",
-                        pair.first.c_str(), str(m).c_str(),
-                        pair.second->str().c_str()));
-    assert(!in(pair.first, m));
-    m[pair.first] = pair.second;
+
+  if (!unification.result) {
+    /* a failed unification leaves no bindings behind */
+    rollback(mark);
   }
-  debug_above(11, log("which gives: %s",
-                      join_with(m, ", ", [](const auto &pair) {
-                        return string_format("%s: %s", pair.first.c_str(),
-                                             pair.second->str().c_str());
-                      }).c_str()));
-  return m;
+  return unification;
 }
 
-Unification compose(const Unification &a, const Unification &b) {
-  if (a.result && b.result) {
-    return Unification{true, INTERNAL_LOC(), "",
-                       compose(a.bindings, b.bindings)};
-  } else {
+Unification TypeVarStore::unify_many(const types::Refs &as,
+                                     const types::Refs &bs) {
+  debug_above(8, log("unify_many([%s], [%s])", join_str(as, ", ").c_str(),
+                     join_str(bs, ", ").c_str()));
+  if (as.size() != bs.size()) {
+    Refs zas = zonk(as);
+    Refs zbs = zonk(bs);
+    Location location = zas.size() != 0
+                            ? (zbs.size() != 0
+                                   ? best_location(zas[0]->get_location(),
+                                                   zbs[0]->get_location())
+                                   : zas[0]->get_location())
+                            : zbs[0]->get_location();
     return Unification{false,
-                       a.result ? b.error_location : a.error_location,
-                       a.result ? b.error_string : a.error_string,
+                       location,
+                       string_format("unification mismatch %s != %s",
+                                     str(zas).c_str(), str(zbs).c_str()),
                        {}};
   }
+
+  /* keep going after a failure so that we report the last error, but don't
+   * keep any of the bindings. */
+  const size_t mark = trail.size();
+  Unification unification{true, INTERNAL_LOC(), "", {}};
+  for (size_t i = 0; i < as.size(); ++i) {
+    auto u = unify(as[i], bs[i]);
+    if (!u.result) {
+      unification = u;
+    }
+  }
+  if (!unification.result) {
+    rollback(mark);
+  }
+  return unification;
 }
 
-std::vector<Ref> rebind_tails(const std::vector<Ref> &types,
-                              const Map &bindings) {
-  assert(1 <= types.size());
-  std::vector<Ref> new_types;
-  for (size_t i = 1; i < types.size(); ++i) {
-    new_types.push_back(types[i]->rebind(bindings));
+Ref TypeVarStore::resolve(const std::string &name) {
+  auto iter = zonked.find(name);
+  if (iter != zonked.end()) {
+    return iter->second;
+  }
+
+  auto parent_iter = parents.find(name);
+  if (parent_iter == parents.end()) {
+    return nullptr;
   }
-  return new_types;
+
+  Ref resolved = zonk(parent_iter->second);
+  zonked[name] = resolved;
+  return resolved;
 }
 
-Unification unify_many(const types::Refs &as, const types::Refs &bs) {
-  debug_above(8, log("unify_many([%s], [%s])", join_str(as, ", ").c_str(),
-                     join_str(bs, ", ").c_str()));
-  Location location = as.size() != 0
-                          ? (bs.size() != 0
-                                 ? best_location(as[0]->get_location(),
-                                                 bs[0]->get_location())
-                                 : as[0]->get_location())
-                          : (bs.size() != 0 ? bs[0]->get_location()
-                                            : INTERNAL_LOC());
-  if (as.size() == 0 && bs.size() == 0) {
-    return Unification{true, location, "", {}};
-  } else if (as.size() != bs.size()) {
-    return Unification{false,
-                       location,
-                       string_format("unification mismatch %s != %s",
-                                     str(as).c_str(), str(bs).c_str()),
-                       {}};
-    /*
-    throw ace::user_error(
-        as.size() != 0
-            ? as[0]->get_location()
-            : (bs.size() != 0 ? bs[0]->get_location() : INTERNAL_LOC()),
-        "unification mismatch %s != %s", join_str(as, " -> ").c_str(),
-        join_str(bs, " -> ").c_str());
-        */
+Ref TypeVarStore::zonk(Ref type) {
+  if (parents.size() == 0) {
+    return type;
+  }
+
+  Map bindings;
+  for (auto &ftv : type->get_ftvs()) {
+    if (auto resolved = resolve(ftv)) {
+      bindings[ftv] = resolved;
+    }
   }
+  return type->rebind(bindings);
+}
+
+Refs TypeVarStore::zonk(const Refs &types) {
+  Refs zonked_types;
+  zonked_types.reserve(types.size());
+  for (auto &type : types) {
+    zonked_types.push_back(zonk(type));
+  }
+  return zonked_types;
+}
 
-  auto u1 = unify(as[0], bs[0]);
-  auto u2 = unify_many(rebind_tails(as, u1.bindings),
-                       rebind_tails(bs, u1.bindings));
-  return compose(u2, u1);
+Map TypeVarStore::get_bindings() {
+  Map bindings;
+  for (auto &pair : parents) {
+    bindings[pair.first] = resolve(pair.first);
+  }
+  return bindings;
+}
+
+Unification unify(Ref a, Ref b) {
+  TypeVarStore store;
+  auto unification = store.unify(a, b);
+  if (unification.result) {
+    unification.bindings = store.get_bindings();
+  }
+  return unification;
+}
+
+Unification unify_many(const types::Refs &as, const types::Refs &bs) {
+  TypeVarStore store;
+  auto unification = store.unify_many(as, bs);
+  if (unification.result) {
+    unification.bindings = store.get_bindings();
+  }
+  return unification;
 }
 
 } // namespace types
@@ -1,6 +1,7 @@
 #pragma once
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "location.h"
@@ -17,11 +18,41 @@ struct Unification {
   types::Map bindings;
 };
 
+/* TypeVarStore is a mutable union-find over type variables. Unifying records
+ * bindings in place (failed unifications are rolled back via a trail), and
+ * types are only fully resolved ("zonked") when someone asks for them. */
+struct TypeVarStore {
+  TypeVarStore();
+  TypeVarStore(const TypeVarStore &) = delete;
+
+  Unification unify(types::Ref a, types::Ref b);
+  Unification unify_many(const types::Refs &as, const types::Refs &bs);
+
+  /* shallow: chase a bound type variable to its representative */
+  types::Ref find(types::Ref type);
+  /* deep: apply every binding in the store to |type| */
+  types::Ref zonk(types::Ref type);
+  types::Refs zonk(const types::Refs &types);
+  /* an idempotent substitution for every bound type variable */
+  types::Map get_bindings();
+
+private:
+  Unification bind(std::string a, types::Ref type);
+  bool occurs(const std::string &name, types::Ref type);
+  types::Ref resolve(const std::string &name);
+  void rollback(size_t mark);
+
+  std::unordered_map<std::string, types::Ref> parents;
+  /* undo log of (name, previous parent). a null parent means unbound. */
+  std::vector<std::pair<std::string, types::Ref>> trail;
+  /* cache of fully resolved bindings, invalidated by any new binding */
+  std::unordered_map<std::string, types::Ref> zonked;
+};
+
 Unification unify(types::Ref a, types::Ref b);
 Unification unify_many(const types::Refs &as, const types::Refs &b);
-types::Map compose(const types::Map &a, const types::Map &b);
-Unification compose(const Unification &a, const Unification &b);
 bool type_equality(types::Ref a, types::Ref b);
+bool scheme_identical(types::Scheme::Ref a, types::Scheme::Ref b);
 types::SchemeRef scheme_unify(types::Scheme::Ref a, types::Scheme::Ref b);
 bool scheme_equality(types::Scheme::Ref a, types::Scheme::Ref b);
 